@@ -0,0 +1,439 @@
+// sparse_autotune.h
+// Copyright Laurence Emms 2020
+
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#include "sparse_csr_mat.h"
+#include "sparse_mat_operations.h"
+
+namespace sparse {
+
+enum class SpMVFormat {
+    CSR,
+    ELL,
+    BCSR
+};
+
+// Structural statistics of a CSR matrix used to select an SpMV format
+struct MatrixFeatures {
+    size_t num_rows;
+    size_t num_cols;
+    size_t nnz;
+    size_t min_row_length;
+    size_t max_row_length;
+    double mean_row_length;
+    double row_length_stddev;
+    // Largest |i - j| over all elements
+    size_t bandwidth;
+    // Fraction of nonzeros in the occupied block_size x block_size blocks
+    double block_density;
+};
+
+template <typename C, typename T>
+MatrixFeatures analyze(const CSRMatrix<C, T>& mat, size_t block_size = 4)
+{
+    MatrixFeatures features;
+    features.num_rows = mat.num_rows();
+    features.num_cols = mat.num_cols();
+    features.nnz = mat.size();
+    features.min_row_length = features.num_rows > 0 ? mat.num_cols() : 0;
+    features.max_row_length = 0;
+    features.bandwidth = 0;
+
+    double sum_squares = 0.0;
+    size_t num_blocks = 0;
+    std::vector<C> block_cols;
+    for (size_t br = 0; br < features.num_rows; br += block_size) {
+        block_cols.clear();
+        for (size_t r = br; r < std::min(br + block_size, features.num_rows); ++r) {
+            typename std::vector<C>::const_iterator col_begin = mat.crow_begin_col(r);
+            typename std::vector<C>::const_iterator col_end = mat.crow_end_col(r);
+            size_t length = col_end - col_begin;
+            features.min_row_length = std::min(features.min_row_length, length);
+            features.max_row_length = std::max(features.max_row_length, length);
+            sum_squares += static_cast<double>(length) * length;
+            for (; col_begin != col_end; ++col_begin) {
+                size_t c = *col_begin;
+                features.bandwidth = std::max(features.bandwidth, c > r ? c - r : r - c);
+                block_cols.push_back(*col_begin / block_size);
+            }
+        }
+        std::sort(block_cols.begin(), block_cols.end());
+        num_blocks += std::unique(block_cols.begin(), block_cols.end()) - block_cols.begin();
+    }
+
+    if (features.num_rows > 0) {
+        features.mean_row_length = static_cast<double>(features.nnz) / features.num_rows;
+        double variance = sum_squares / features.num_rows
+            - features.mean_row_length * features.mean_row_length;
+        features.row_length_stddev = std::sqrt(std::max(variance, 0.0));
+    } else {
+        features.mean_row_length = 0.0;
+        features.row_length_stddev = 0.0;
+    }
+    features.block_density = num_blocks > 0
+        ? static_cast<double>(features.nnz) / (num_blocks * block_size * block_size)
+        : 0.0;
+    return features;
+}
+
+// FNV-1a hash of the dimensions and sparsity pattern. Values are not
+// included, so matrices sharing a pattern share a tuning result. seed is
+// hashed in as well, to key different uses of the same pattern apart.
+template <typename C, typename T>
+uint64_t fingerprint(const CSRMatrix<C, T>& mat, uint64_t seed = 0)
+{
+    uint64_t hash = 14695981039346656037ull;
+    auto mix = [&hash](uint64_t v) {
+        for (int b = 0; b < 8; ++b) {
+            hash ^= (v >> (b * 8)) & 0xff;
+            hash *= 1099511628211ull;
+        }
+    };
+    mix(seed);
+    mix(mat.num_rows());
+    mix(mat.num_cols());
+    mix(mat.size());
+    for (int r = 0, r_end = mat.num_rows(); r < r_end; ++r) {
+        typename std::vector<C>::const_iterator col_begin = mat.crow_begin_col(r);
+        typename std::vector<C>::const_iterator col_end = mat.crow_end_col(r);
+        mix(col_end - col_begin);
+        for (; col_begin != col_end; ++col_begin) {
+            mix(*col_begin);
+        }
+    }
+    return hash;
+}
+
+// Maps matrix fingerprints to previously selected formats
+class TuningCache {
+    std::unordered_map<uint64_t, SpMVFormat> _formats;
+
+public:
+    TuningCache() {}
+
+    bool find(uint64_t key, SpMVFormat& format) const;
+    void insert(uint64_t key, SpMVFormat format);
+
+    size_t size() const;
+    void clear();
+};
+
+inline bool TuningCache::find(uint64_t key, SpMVFormat& format) const
+{
+    auto it = _formats.find(key);
+    if (it != _formats.end()) {
+        format = it->second;
+        return true;
+    }
+    return false;
+}
+
+inline void TuningCache::insert(uint64_t key, SpMVFormat format)
+{
+    _formats[key] = format;
+}
+
+inline size_t TuningCache::size() const
+{
+    return _formats.size();
+}
+
+inline void TuningCache::clear()
+{
+    _formats.clear();
+}
+
+// SpMV operator holding a copy of a matrix in the selected storage format
+template <typename C, typename T>
+class TunedOperator {
+public:
+    static constexpr C block_size = 4;
+
+private:
+    SpMVFormat _format;
+    C _num_rows;
+    C _num_cols;
+
+    // CSR
+    CSRMatrix<C, T> _csr;
+
+    // ELL, stored slot-major so consecutive rows are contiguous
+    C _ell_width;
+    std::vector<C> _ell_columns;
+    std::vector<T> _ell_values;
+
+    // BCSR, dense block_size x block_size row-major blocks
+    std::vector<C> _block_rows;
+    std::vector<C> _block_columns;
+    std::vector<T> _block_values;
+
+    void apply_csr(std::vector<T>& out, const std::vector<T>& in) const;
+    void apply_ell(std::vector<T>& out, const std::vector<T>& in) const;
+    void apply_bcsr(std::vector<T>& out, const std::vector<T>& in) const;
+
+public:
+    TunedOperator(const CSRMatrix<C, T>& mat, SpMVFormat format);
+
+    SpMVFormat format() const;
+    size_t num_rows() const;
+    size_t num_cols() const;
+
+    // out is resized to the number of rows
+    void apply(std::vector<T>& out, const std::vector<T>& in) const;
+};
+
+template <typename C, typename T>
+TunedOperator<C, T>::TunedOperator(const CSRMatrix<C, T>& mat, SpMVFormat format) :
+    _format(format),
+    _num_rows(mat.num_rows()),
+    _num_cols(mat.num_cols()),
+    _csr(0, mat.num_cols()),
+    _ell_width(0)
+{
+    switch (_format) {
+    case SpMVFormat::CSR:
+        _csr = mat;
+        break;
+    case SpMVFormat::ELL:
+        for (C r = 0; r < _num_rows; ++r) {
+            _ell_width = std::max(_ell_width, static_cast<C>(mat.crow_end_col(r) - mat.crow_begin_col(r)));
+        }
+        // Padding slots point at column 0 with a zero value
+        _ell_columns.assign(static_cast<size_t>(_ell_width) * _num_rows, static_cast<C>(0));
+        _ell_values.assign(static_cast<size_t>(_ell_width) * _num_rows, static_cast<T>(0));
+        for (C r = 0; r < _num_rows; ++r) {
+            typename std::vector<C>::const_iterator col_begin = mat.crow_begin_col(r);
+            typename std::vector<C>::const_iterator col_end = mat.crow_end_col(r);
+            typename std::vector<T>::const_iterator col_value = mat.crow_begin(r);
+            for (C k = 0; col_begin != col_end; ++col_begin, ++col_value, ++k) {
+                _ell_columns[static_cast<size_t>(k) * _num_rows + r] = *col_begin;
+                _ell_values[static_cast<size_t>(k) * _num_rows + r] = *col_value;
+            }
+        }
+        break;
+    case SpMVFormat::BCSR:
+        _block_rows.push_back(static_cast<C>(0));
+        for (C br = 0; br < _num_rows; br += block_size) {
+            C r_end = std::min(static_cast<C>(br + block_size), _num_rows);
+            size_t first_block = _block_columns.size();
+            for (C r = br; r < r_end; ++r) {
+                for (typename std::vector<C>::const_iterator col_begin = mat.crow_begin_col(r);
+                     col_begin != mat.crow_end_col(r); ++col_begin) {
+                    _block_columns.push_back(*col_begin / block_size);
+                }
+            }
+            std::sort(_block_columns.begin() + first_block, _block_columns.end());
+            _block_columns.erase(
+                std::unique(_block_columns.begin() + first_block, _block_columns.end()),
+                _block_columns.end());
+            _block_values.resize(_block_columns.size() * block_size * block_size, static_cast<T>(0));
+            for (C r = br; r < r_end; ++r) {
+                typename std::vector<C>::const_iterator col_begin = mat.crow_begin_col(r);
+                typename std::vector<C>::const_iterator col_end = mat.crow_end_col(r);
+                typename std::vector<T>::const_iterator col_value = mat.crow_begin(r);
+                for (; col_begin != col_end; ++col_begin, ++col_value) {
+                    size_t b = std::lower_bound(
+                        _block_columns.begin() + first_block, _block_columns.end(),
+                        *col_begin / block_size) - _block_columns.begin();
+                    _block_values[(b * block_size + (r - br)) * block_size + *col_begin % block_size] = *col_value;
+                }
+            }
+            _block_rows.push_back(static_cast<C>(_block_columns.size()));
+        }
+        break;
+    }
+}
+
+template <typename C, typename T>
+SpMVFormat TunedOperator<C, T>::format() const
+{
+    return _format;
+}
+
+template <typename C, typename T>
+size_t TunedOperator<C, T>::num_rows() const
+{
+    return _num_rows;
+}
+
+template <typename C, typename T>
+size_t TunedOperator<C, T>::num_cols() const
+{
+    return _num_cols;
+}
+
+template <typename C, typename T>
+void TunedOperator<C, T>::apply(std::vector<T>& out, const std::vector<T>& in) const
+{
+    assert(in.size() == static_cast<size_t>(_num_cols));
+    switch (_format) {
+    case SpMVFormat::CSR:
+        apply_csr(out, in);
+        break;
+    case SpMVFormat::ELL:
+        apply_ell(out, in);
+        break;
+    case SpMVFormat::BCSR:
+        apply_bcsr(out, in);
+        break;
+    }
+}
+
+template <typename C, typename T>
+void TunedOperator<C, T>::apply_csr(std::vector<T>& out, const std::vector<T>& in) const
+{
+    matmul(out, _csr, in);
+}
+
+template <typename C, typename T>
+void TunedOperator<C, T>::apply_ell(std::vector<T>& out, const std::vector<T>& in) const
+{
+    out.assign(_num_rows, static_cast<T>(0));
+    for (C k = 0; k < _ell_width; ++k) {
+        const C* columns = _ell_columns.data() + static_cast<size_t>(k) * _num_rows;
+        const T* values = _ell_values.data() + static_cast<size_t>(k) * _num_rows;
+        for (C r = 0; r < _num_rows; ++r) {
+            out[r] += values[r] * in[columns[r]];
+        }
+    }
+}
+
+template <typename C, typename T>
+void TunedOperator<C, T>::apply_bcsr(std::vector<T>& out, const std::vector<T>& in) const
+{
+    out.assign(_num_rows, static_cast<T>(0));
+    for (C br = 0, b_row = 0; br < _num_rows; br += block_size, ++b_row) {
+        C rows = std::min(static_cast<C>(_num_rows - br), block_size);
+        for (C b = _block_rows[b_row]; b < _block_rows[b_row + 1]; ++b) {
+            C bc = _block_columns[b] * block_size;
+            C cols = std::min(static_cast<C>(_num_cols - bc), block_size);
+            const T* block = _block_values.data() + static_cast<size_t>(b) * block_size * block_size;
+            for (C i = 0; i < rows; ++i) {
+                T acc = static_cast<T>(0);
+                for (C j = 0; j < cols; ++j) {
+                    acc += block[i * block_size + j] * in[bc + j];
+                }
+                out[br + i] += acc;
+            }
+        }
+    }
+}
+
+// Select a format from the matrix features alone
+inline SpMVFormat select_format(const MatrixFeatures& features)
+{
+    // Dense blocks amortize one column index over a whole block
+    if (features.block_density >= 0.5) {
+        return SpMVFormat::BCSR;
+    }
+    // Regular row lengths keep the ELL padding overhead small
+    if (features.num_rows > 0 &&
+        features.max_row_length * features.num_rows <= features.nnz + features.nnz / 2) {
+        return SpMVFormat::ELL;
+    }
+    return SpMVFormat::CSR;
+}
+
+// Stored slots per nonzero of a format, including ELL padding and the
+// explicit zeros of BCSR blocks
+inline double fill_ratio(const MatrixFeatures& features, SpMVFormat format)
+{
+    switch (format) {
+    case SpMVFormat::ELL:
+        return features.nnz > 0
+            ? static_cast<double>(features.max_row_length) * features.num_rows / features.nnz
+            : 1.0;
+    case SpMVFormat::BCSR:
+        return features.block_density > 0.0 ? 1.0 / features.block_density : 1.0;
+    default:
+        return 1.0;
+    }
+}
+
+// Time each candidate format on the leading sample_rows rows of the matrix.
+// Candidates whose fill ratio exceeds max_fill on either the sample or the
+// whole matrix are not built, so skewed matrices cannot blow up the padded
+// formats.
+template <typename C, typename T>
+SpMVFormat benchmark_format(
+    const CSRMatrix<C, T>& mat,
+    size_t sample_rows = 4096,
+    int repetitions = 5,
+    double max_fill = 3.0)
+{
+    C num_rows = static_cast<C>(std::min(sample_rows, mat.num_rows()));
+    CSRMatrix<C, T> sample(num_rows, mat.num_cols());
+    for (C r = 0; r < num_rows; ++r) {
+        sample.add_row();
+        typename std::vector<C>::const_iterator col_begin = mat.crow_begin_col(r);
+        typename std::vector<C>::const_iterator col_end = mat.crow_end_col(r);
+        typename std::vector<T>::const_iterator col_value = mat.crow_begin(r);
+        for (; col_begin != col_end; ++col_begin, ++col_value) {
+            sample.push(*col_begin, *col_value);
+        }
+    }
+
+    MatrixFeatures features = analyze(mat, TunedOperator<C, T>::block_size);
+    MatrixFeatures sample_features = analyze(sample, TunedOperator<C, T>::block_size);
+
+    std::vector<T> in(mat.num_cols(), static_cast<T>(1));
+    std::vector<T> out;
+    const SpMVFormat candidates[] = {SpMVFormat::CSR, SpMVFormat::ELL, SpMVFormat::BCSR};
+    SpMVFormat best = SpMVFormat::CSR;
+    std::chrono::steady_clock::duration best_time = std::chrono::steady_clock::duration::max();
+    for (SpMVFormat candidate : candidates) {
+        if (fill_ratio(features, candidate) > max_fill ||
+            fill_ratio(sample_features, candidate) > max_fill) {
+            continue;
+        }
+        TunedOperator<C, T> op(sample, candidate);
+        // Warm up
+        op.apply(out, in);
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        for (int i = 0; i < repetitions; ++i) {
+            op.apply(out, in);
+        }
+        std::chrono::steady_clock::duration time = std::chrono::steady_clock::now() - start;
+        if (time < best_time) {
+            best_time = time;
+            best = candidate;
+        }
+    }
+    return best;
+}
+
+// Build an SpMV operator in the best format for mat. If cache is provided,
+// results are looked up and stored by matrix fingerprint and selection mode,
+// so a benchmarked choice is never served from a heuristic one or vice versa.
+template <typename C, typename T>
+TunedOperator<C, T> tune(const CSRMatrix<C, T>& mat, bool benchmark = false, TuningCache* cache = nullptr)
+{
+    uint64_t key = 0;
+    SpMVFormat format;
+    if (cache) {
+        key = fingerprint(mat, benchmark ? 1 : 0);
+        if (cache->find(key, format)) {
+            return TunedOperator<C, T>(mat, format);
+        }
+    }
+    if (benchmark) {
+        format = benchmark_format(mat);
+    } else {
+        format = select_format(analyze(mat, TunedOperator<C, T>::block_size));
+    }
+    if (cache) {
+        cache->insert(key, format);
+    }
+    return TunedOperator<C, T>(mat, format);
+}
+
+} // namespace sparse
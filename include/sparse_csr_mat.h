@@ -13,6 +13,7 @@ class CSRMatrix {
     C _current_row_end;
     C _num_rows;
     C _num_cols;
+    bool _pattern_locked;
     std::vector<T> _values;
     std::vector<C> _columns;
     std::vector<C> _rows;
@@ -47,6 +48,12 @@ public:
     size_t num_rows() const;
     size_t num_cols() const;
 
+    // A locked pattern may not be extended or cleared, only its values
+    // may be modified
+    void lock_pattern();
+    void unlock_pattern();
+    bool pattern_locked() const;
+
     void clear();
 };
 
@@ -54,7 +61,8 @@ template <typename C, typename T>
 CSRMatrix<C, T>::CSRMatrix(const C& num_rows, const C& num_cols) :
     _current_row_end(0),
     _num_rows(num_rows),
-    _num_cols(num_cols)
+    _num_cols(num_cols),
+    _pattern_locked(false)
 {
     _rows.reserve(_num_rows + 1);
     _rows.push_back(static_cast<C>(0));
@@ -119,6 +127,7 @@ CSRMatrix<C, T>::crow_end(const C& i) const
 template <typename C, typename T>
 void CSRMatrix<C, T>::add_row()
 {
+    assert(!_pattern_locked);
     assert(_current_row_end < _num_rows + 1);
     _rows.push_back(_rows.back());
     ++_current_row_end;
@@ -128,6 +137,7 @@ void CSRMatrix<C, T>::add_row()
 template <typename C, typename T>
 void CSRMatrix<C, T>::push(const C& c, const T& v)
 {
+    assert(!_pattern_locked);
     _columns.push_back(c);
     _values.push_back(v);
     ++_rows[_current_row_end];
@@ -138,6 +148,7 @@ void CSRMatrix<C, T>::push_back_row(
     const std::vector<C>& columns,
     const std::vector<T>& values)
 {
+    assert(!_pattern_locked);
     assert(columns.size() == values.size());
     _values.insert(_values.end(), values.begin(), values.end());
     _columns.insert(_columns.end(), columns.begin(), columns.end());
@@ -180,9 +191,28 @@ size_t CSRMatrix<C, T>::num_cols() const
     return _num_cols;
 }
 
+template <typename C, typename T>
+void CSRMatrix<C, T>::lock_pattern()
+{
+    _pattern_locked = true;
+}
+
+template <typename C, typename T>
+void CSRMatrix<C, T>::unlock_pattern()
+{
+    _pattern_locked = false;
+}
+
+template <typename C, typename T>
+bool CSRMatrix<C, T>::pattern_locked() const
+{
+    return _pattern_locked;
+}
+
 template <typename C, typename T>
 void CSRMatrix<C, T>::clear()
 {
+    assert(!_pattern_locked);
     _current_row_end = 0;
     _values.clear();
     _columns.clear();
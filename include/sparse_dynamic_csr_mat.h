@@ -0,0 +1,237 @@
+// sparse_dynamic_csr_mat.h
+// Copyright Laurence Emms 2020
+
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <vector>
+
+#include "sparse_csr_mat.h"
+
+namespace sparse {
+
+// CSR matrix which accepts insertions and removals anywhere in the matrix.
+// Updates are buffered in sorted per-row delta lists on top of an immutable
+// base CSR matrix. Reads go through both the delta and the base, and the
+// deltas are merged into a fresh base once the number of pending updates
+// crosses the merge threshold.
+template <typename C, typename T>
+class DynamicCSRMatrix {
+public:
+    struct Delta {
+        C column;
+        T value;
+        bool removed;
+    };
+
+private:
+    C _num_rows;
+    C _num_cols;
+    size_t _merge_threshold;
+    size_t _num_pending;
+    CSRMatrix<C, T> _base;
+    std::vector<std::vector<Delta>> _deltas;
+
+    void update(const C& i, const C& j, const T& t, bool removed);
+
+public:
+    // A merge threshold of zero disables automatic compaction
+    DynamicCSRMatrix(const C& num_rows, const C& num_cols, size_t merge_threshold = 1024);
+    DynamicCSRMatrix(const CSRMatrix<C, T>& base, size_t merge_threshold = 1024);
+
+    const CSRMatrix<C, T>& base() const;
+
+    typename std::vector<Delta>::const_iterator crow_begin_delta(const C& i) const;
+    typename std::vector<Delta>::const_iterator crow_end_delta(const C& i) const;
+
+    // Insert or overwrite element
+    void insert(const C& i, const C& j, const T& t);
+
+    // Remove element if present
+    void remove(const C& i, const C& j);
+
+    // Logarithmic access time in the delta, linear in the base rows
+    T get(const C& i, const C& j) const;
+
+    // Merge the deltas into a fresh base matrix
+    void compact();
+
+    // Number of buffered updates
+    size_t num_pending() const;
+    size_t num_rows() const;
+    size_t num_cols() const;
+
+    void clear();
+};
+
+template <typename C, typename T>
+DynamicCSRMatrix<C, T>::DynamicCSRMatrix(
+    const C& num_rows,
+    const C& num_cols,
+    size_t merge_threshold) :
+    _num_rows(num_rows),
+    _num_cols(num_cols),
+    _merge_threshold(merge_threshold),
+    _num_pending(0),
+    _base(num_rows, num_cols),
+    _deltas(num_rows)
+{
+    for (C r = 0; r < _num_rows; ++r) {
+        _base.add_row();
+    }
+}
+
+template <typename C, typename T>
+DynamicCSRMatrix<C, T>::DynamicCSRMatrix(
+    const CSRMatrix<C, T>& base,
+    size_t merge_threshold) :
+    _num_rows(base.num_rows()),
+    _num_cols(base.num_cols()),
+    _merge_threshold(merge_threshold),
+    _num_pending(0),
+    _base(base),
+    _deltas(base.num_rows())
+{
+    // The base is owned and rebuilt by compact
+    _base.unlock_pattern();
+}
+
+template <typename C, typename T>
+const CSRMatrix<C, T>& DynamicCSRMatrix<C, T>::base() const
+{
+    return _base;
+}
+
+template <typename C, typename T>
+typename std::vector<typename DynamicCSRMatrix<C, T>::Delta>::const_iterator
+DynamicCSRMatrix<C, T>::crow_begin_delta(const C& i) const
+{
+    return _deltas[i].cbegin();
+}
+
+template <typename C, typename T>
+typename std::vector<typename DynamicCSRMatrix<C, T>::Delta>::const_iterator
+DynamicCSRMatrix<C, T>::crow_end_delta(const C& i) const
+{
+    return _deltas[i].cend();
+}
+
+template <typename C, typename T>
+void DynamicCSRMatrix<C, T>::update(const C& i, const C& j, const T& t, bool removed)
+{
+    assert(i < _num_rows);
+    assert(j < _num_cols);
+    std::vector<Delta>& row = _deltas[i];
+    typename std::vector<Delta>::iterator it = std::lower_bound(
+        row.begin(), row.end(), j,
+        [](const Delta& d, const C& c) { return d.column < c; });
+    if (it != row.end() && it->column == j) {
+        it->value = t;
+        it->removed = removed;
+    } else {
+        row.insert(it, Delta{j, t, removed});
+        ++_num_pending;
+    }
+    if (_merge_threshold > 0 && _num_pending >= _merge_threshold) {
+        compact();
+    }
+}
+
+template <typename C, typename T>
+void DynamicCSRMatrix<C, T>::insert(const C& i, const C& j, const T& t)
+{
+    update(i, j, t, false);
+}
+
+template <typename C, typename T>
+void DynamicCSRMatrix<C, T>::remove(const C& i, const C& j)
+{
+    update(i, j, static_cast<T>(0), true);
+}
+
+template <typename C, typename T>
+T DynamicCSRMatrix<C, T>::get(const C& i, const C& j) const
+{
+    if (i < _num_rows) {
+        const std::vector<Delta>& row = _deltas[i];
+        typename std::vector<Delta>::const_iterator it = std::lower_bound(
+            row.cbegin(), row.cend(), j,
+            [](const Delta& d, const C& c) { return d.column < c; });
+        if (it != row.cend() && it->column == j) {
+            return it->removed ? static_cast<T>(0) : it->value;
+        }
+    }
+    return _base.get(i, j);
+}
+
+// Merge each base row with its delta row. Base rows are assumed to be sorted
+// by column, as produced by push and push_back_row.
+template <typename C, typename T>
+void DynamicCSRMatrix<C, T>::compact()
+{
+    if (_num_pending == 0) {
+        return;
+    }
+    CSRMatrix<C, T> merged(_num_rows, _num_cols);
+    for (C r = 0; r < _num_rows; ++r) {
+        merged.add_row();
+        typename std::vector<C>::const_iterator col_begin = _base.crow_begin_col(r);
+        typename std::vector<C>::const_iterator col_end = _base.crow_end_col(r);
+        typename std::vector<T>::const_iterator col_value = _base.crow_begin(r);
+        typename std::vector<Delta>::const_iterator delta_begin = _deltas[r].cbegin();
+        typename std::vector<Delta>::const_iterator delta_end = _deltas[r].cend();
+        while (col_begin != col_end || delta_begin != delta_end) {
+            if (delta_begin == delta_end ||
+                (col_begin != col_end && *col_begin < delta_begin->column)) {
+                merged.push(*col_begin, *col_value);
+                ++col_begin;
+                ++col_value;
+                continue;
+            }
+            if (col_begin != col_end && *col_begin == delta_begin->column) {
+                // Delta overrides the base element
+                ++col_begin;
+                ++col_value;
+            }
+            if (!delta_begin->removed) {
+                merged.push(delta_begin->column, delta_begin->value);
+            }
+            ++delta_begin;
+        }
+        _deltas[r].clear();
+    }
+    _base = std::move(merged);
+    _num_pending = 0;
+}
+
+template <typename C, typename T>
+size_t DynamicCSRMatrix<C, T>::num_pending() const
+{
+    return _num_pending;
+}
+
+template <typename C, typename T>
+size_t DynamicCSRMatrix<C, T>::num_rows() const
+{
+    return _num_rows;
+}
+
+template <typename C, typename T>
+size_t DynamicCSRMatrix<C, T>::num_cols() const
+{
+    return _num_cols;
+}
+
+template <typename C, typename T>
+void DynamicCSRMatrix<C, T>::clear()
+{
+    _base.clear();
+    for (C r = 0; r < _num_rows; ++r) {
+        _base.add_row();
+        _deltas[r].clear();
+    }
+    _num_pending = 0;
+}
+
+} // namespace sparse
@@ -0,0 +1,126 @@
+// sparse_graph.h
+// Copyright Laurence Emms 2020
+
+#pragma once
+
+#include <cassert>
+#include <vector>
+
+#include "sparse_csc_mat.h"
+#include "sparse_csr_mat.h"
+#include "sparse_list_vector.h"
+#include "sparse_mat_operations.h"
+#include "sparse_semiring.h"
+
+namespace sparse {
+
+// Direction-optimizing breadth first search over the adjacency matrix A,
+// where element (i, j) is the edge j -> i, so one step of the search is
+// next = A * frontier over the or-and semiring. The same matrix is given in
+// both formats: adj_cols is used to push a sparse frontier along the edges
+// leaving it, and adj_rows is used to pull into each unvisited vertex from a
+// bitmap frontier, stopping at its first neighbour in the frontier. Elements
+// stored with value zero are not edges in either direction.
+//
+// The search switches from push to pull while the frontier is growing and
+// the edges leaving it exceed 1 / alpha of the edges leaving unvisited
+// vertices, and back to push while the frontier is shrinking and holds fewer
+// than 1 / beta of the vertices.
+//
+// levels is resized to the number of vertices and holds the depth of each
+// vertex from source, or -1 for unreachable vertices. C must be signed. If
+// pulled is given, it records for each step whether it pulled.
+template <typename C, typename T>
+void bfs(
+    std::vector<C>& levels,
+    const CSRMatrix<C, T>& adj_rows,
+    const CSCMatrix<C, T>& adj_cols,
+    const C& source,
+    double alpha = 14.0,
+    double beta = 24.0,
+    std::vector<bool>* pulled = nullptr)
+{
+    typedef OrAnd<T> S;
+    assert(adj_rows.num_rows() == adj_rows.num_cols());
+    assert(adj_cols.num_rows() == adj_rows.num_rows());
+    assert(adj_cols.num_cols() == adj_rows.num_cols());
+    size_t n = adj_rows.num_rows();
+    assert(static_cast<size_t>(source) < n);
+
+    levels.assign(n, static_cast<C>(-1));
+    if (pulled) {
+        pulled->clear();
+    }
+    std::vector<bool> visited(n, false);
+    levels[source] = 0;
+    visited[source] = true;
+
+    ListVector<C, T> frontier;
+    frontier.push_back(source, static_cast<T>(1));
+    std::vector<bool> frontier_bitmap;
+    size_t frontier_size = 1;
+    size_t prev_frontier_size = 0;
+    size_t frontier_edges = adj_cols.ccol_end_row(source) - adj_cols.ccol_begin_row(source);
+    size_t unvisited_edges = adj_cols.size() - frontier_edges;
+    bool pull = false;
+
+    for (C level = 1; frontier_size > 0; ++level) {
+        bool growing = frontier_size > prev_frontier_size;
+        bool shrinking = frontier_size < prev_frontier_size;
+        if (!pull && growing && frontier_edges > unvisited_edges / alpha) {
+            pull = true;
+            frontier_bitmap.assign(n, false);
+            for (typename std::vector<std::pair<C, T>>::const_iterator it = frontier.cbegin();
+                 it != frontier.cend(); ++it) {
+                frontier_bitmap[it->first] = true;
+            }
+        } else if (pull && shrinking && frontier_size < n / beta) {
+            pull = false;
+            frontier = ListVector<C, T>();
+            for (size_t v = 0; v < n; ++v) {
+                if (frontier_bitmap[v]) {
+                    frontier.push_back(v, static_cast<T>(1));
+                }
+            }
+        }
+
+        if (pulled) {
+            pulled->push_back(pull);
+        }
+        prev_frontier_size = frontier_size;
+        frontier_size = 0;
+        frontier_edges = 0;
+        if (pull) {
+            std::vector<T> next;
+            matmul<S>(next, adj_rows, frontier_bitmap, &visited, true);
+            for (size_t v = 0; v < n; ++v) {
+                frontier_bitmap[v] = next[v] != S::zero();
+                if (frontier_bitmap[v]) {
+                    levels[v] = level;
+                    visited[v] = true;
+                    ++frontier_size;
+                    frontier_edges += adj_cols.ccol_end_row(v) - adj_cols.ccol_begin_row(v);
+                }
+            }
+        } else {
+            ListVector<C, T> next;
+            matmul<S>(next, adj_cols, frontier, &visited, true);
+            frontier = ListVector<C, T>();
+            for (typename std::vector<std::pair<C, T>>::const_iterator it = next.cbegin();
+                 it != next.cend(); ++it) {
+                // Touched only through elements stored as zero
+                if (it->second == S::zero()) {
+                    continue;
+                }
+                frontier.push_back(it->first, it->second);
+                levels[it->first] = level;
+                visited[it->first] = true;
+                ++frontier_size;
+                frontier_edges += adj_cols.ccol_end_row(it->first) - adj_cols.ccol_begin_row(it->first);
+            }
+        }
+        unvisited_edges -= frontier_edges;
+    }
+}
+
+} // namespace sparse
@@ -23,6 +23,9 @@ public:
     void insert(const C& c, const T& t);
 
     T get(const C& c) const;
+
+    // Returns false if no element is stored at c
+    bool find(const C& c, T& t) const;
 };
 
 template <typename C, typename T>
@@ -39,4 +42,14 @@ T MapVector<C, T>::get(const C& c) const {
     return static_cast<T>(0);
 }
 
+template <typename C, typename T>
+bool MapVector<C, T>::find(const C& c, T& t) const {
+    auto it = _values.find(c);
+    if (it != _values.end()) {
+        t = it->second;
+        return true;
+    }
+    return false;
+}
+
 } // namespace sparse
@@ -3,6 +3,13 @@
 
 #pragma once
 
+#include <algorithm>
+#include <cassert>
+#include <vector>
+
+#include "sparse_parallel.h"
+#include "sparse_semiring.h"
+
 namespace sparse {
 
 template <typename C, typename T>
@@ -11,17 +18,37 @@ class CSCMatrix;
 template <typename C, typename T>
 class CSRMatrix;
 
+template <typename C, typename T>
+class DynamicCSRMatrix;
+
 template <typename C, typename T>
 class ListVector;
 
 template <typename C, typename T>
 class MapVector;
 
-// out must be an empty vector
-template <typename C, typename T>
-void matmul(ListVector<C, T>& out, const CSRMatrix<C, T>& mat, const ListVector<C, T>& in)
+// True if the optional output mask excludes index i. A complemented mask
+// excludes the set entries instead.
+inline bool mask_excludes(const std::vector<bool>* mask, bool complement_mask, size_t i)
 {
+    return mask && (*mask)[i] == complement_mask;
+}
+
+// out must be an empty vector. Rows excluded by the mask are skipped and
+// get no element.
+template <typename S, typename C, typename T>
+void matmul(
+    ListVector<C, T>& out,
+    const CSRMatrix<C, T>& mat,
+    const ListVector<C, T>& in,
+    const std::vector<bool>* mask = nullptr,
+    bool complement_mask = false)
+{
+    assert(!mask || mask->size() == mat.num_rows());
     for (int r = 0, r_end = mat.num_rows(); r < r_end; ++r) {
+        if (mask_excludes(mask, complement_mask, r)) {
+            continue;
+        }
         typename std::vector<C>::const_iterator col_begin = mat.crow_begin_col(r);
         typename std::vector<C>::const_iterator col_end = mat.crow_end_col(r);
         typename std::vector<T>::const_iterator col_value = mat.crow_begin(r);
@@ -29,14 +56,14 @@ void matmul(ListVector<C, T>& out, const CSRMatrix<C, T>& mat, const ListVector<
             // Empty row
             continue;
         }
-        T acc = static_cast<T>(0);
+        T acc = S::zero();
         typename std::vector<std::pair<C, T>>::const_iterator in_it = in.cbegin();
         for (; col_begin != col_end && in_it != in.cend(); ++col_begin, ++col_value) {
-            while (in_it->first < *col_begin) {
+            while (in_it != in.cend() && in_it->first < *col_begin) {
                 ++in_it;
             }
-            if (in_it->first == *col_begin) {
-                acc += *col_value * in_it->second;
+            if (in_it != in.cend() && in_it->first == *col_begin) {
+                acc = S::add(acc, S::mul(*col_value, in_it->second));
             }
         }
         out.push_back(r, acc);
@@ -45,9 +72,26 @@ void matmul(ListVector<C, T>& out, const CSRMatrix<C, T>& mat, const ListVector<
 
 // out must be an empty vector
 template <typename C, typename T>
-void matmul(MapVector<C, T>& out, const CSRMatrix<C, T>& mat, const MapVector<C, T>& in)
+void matmul(ListVector<C, T>& out, const CSRMatrix<C, T>& mat, const ListVector<C, T>& in)
 {
+    matmul<PlusTimes<T>>(out, mat, in);
+}
+
+// out must be an empty vector. Rows excluded by the mask are skipped and
+// get no element.
+template <typename S, typename C, typename T>
+void matmul(
+    MapVector<C, T>& out,
+    const CSRMatrix<C, T>& mat,
+    const MapVector<C, T>& in,
+    const std::vector<bool>* mask = nullptr,
+    bool complement_mask = false)
+{
+    assert(!mask || mask->size() == mat.num_rows());
     for (int r = 0, r_end = mat.num_rows(); r < r_end; ++r) {
+        if (mask_excludes(mask, complement_mask, r)) {
+            continue;
+        }
         typename std::vector<C>::const_iterator col_begin = mat.crow_begin_col(r);
         typename std::vector<C>::const_iterator col_end = mat.crow_end_col(r);
         typename std::vector<T>::const_iterator col_value = mat.crow_begin(r);
@@ -55,41 +99,394 @@ void matmul(MapVector<C, T>& out, const CSRMatrix<C, T>& mat, const MapVector<C,
             // Empty row
             continue;
         }
-        T acc = static_cast<T>(0);
+        T acc = S::zero();
+        T value;
         for (; col_begin != col_end; ++col_begin, ++col_value) {
-            acc += *col_value * in.get(*col_begin);
+            // Missing elements are S::zero(), which need not be 0
+            if (in.find(*col_begin, value)) {
+                acc = S::add(acc, S::mul(*col_value, value));
+            }
         }
         out.insert(r, acc);
     }
 }
 
-// out must be an empty matrix
+// out must be an empty vector
+template <typename C, typename T>
+void matmul(MapVector<C, T>& out, const CSRMatrix<C, T>& mat, const MapVector<C, T>& in)
+{
+    matmul<PlusTimes<T>>(out, mat, in);
+}
+
+// Dense vectors, out is resized to the number of rows. Rows excluded by the
+// mask are set to S::zero() without being computed. Each row stops
+// accumulating once the semiring reports a terminal value. in may also be a
+// std::vector<bool> bitmap, whose set entries are read as 1.
+template <typename S, typename C, typename T, typename U>
+void matmul(
+    std::vector<T>& out,
+    const CSRMatrix<C, T>& mat,
+    const std::vector<U>& in,
+    const std::vector<bool>* mask = nullptr,
+    bool complement_mask = false)
+{
+    assert(in.size() == mat.num_cols());
+    assert(!mask || mask->size() == mat.num_rows());
+    out.assign(mat.num_rows(), S::zero());
+    for (int r = 0, r_end = mat.num_rows(); r < r_end; ++r) {
+        if (mask_excludes(mask, complement_mask, r)) {
+            continue;
+        }
+        typename std::vector<C>::const_iterator col_begin = mat.crow_begin_col(r);
+        typename std::vector<C>::const_iterator col_end = mat.crow_end_col(r);
+        typename std::vector<T>::const_iterator col_value = mat.crow_begin(r);
+        T acc = S::zero();
+        for (; col_begin != col_end && !S::terminal(acc); ++col_begin, ++col_value) {
+            acc = S::add(acc, S::mul(*col_value, static_cast<T>(in[*col_begin])));
+        }
+        out[r] = acc;
+    }
+}
+
+// Dense vectors, out is resized to the number of rows
+template <typename C, typename T>
+void matmul(std::vector<T>& out, const CSRMatrix<C, T>& mat, const std::vector<T>& in)
+{
+    matmul<PlusTimes<T>>(out, mat, in);
+}
+
+// Sparse matrix times sparse vector, pushing each input element along its
+// column through a dense accumulator. out must be an empty vector and is
+// filled in row order with the rows reached and not excluded by the mask.
+template <typename S, typename C, typename T>
+void matmul(
+    ListVector<C, T>& out,
+    const CSCMatrix<C, T>& mat,
+    const ListVector<C, T>& in,
+    const std::vector<bool>* mask = nullptr,
+    bool complement_mask = false)
+{
+    assert(!mask || mask->size() == mat.num_rows());
+    std::vector<T> acc(mat.num_rows(), S::zero());
+    std::vector<bool> touched(mat.num_rows(), false);
+    std::vector<C> touched_rows;
+    typename std::vector<std::pair<C, T>>::const_iterator in_it = in.cbegin();
+    for (; in_it != in.cend(); ++in_it) {
+        typename std::vector<C>::const_iterator row_begin = mat.ccol_begin_row(in_it->first);
+        typename std::vector<C>::const_iterator row_end = mat.ccol_end_row(in_it->first);
+        typename std::vector<T>::const_iterator row_value = mat.ccol_begin(in_it->first);
+        for (; row_begin != row_end; ++row_begin, ++row_value) {
+            C r = *row_begin;
+            if (mask_excludes(mask, complement_mask, r)) {
+                continue;
+            }
+            if (!touched[r]) {
+                touched[r] = true;
+                touched_rows.push_back(r);
+            }
+            acc[r] = S::add(acc[r], S::mul(*row_value, in_it->second));
+        }
+    }
+    std::sort(touched_rows.begin(), touched_rows.end());
+    for (C r : touched_rows) {
+        out.push_back(r, acc[r]);
+    }
+}
+
+// out must be an empty vector
+template <typename C, typename T>
+void matmul(ListVector<C, T>& out, const CSCMatrix<C, T>& mat, const ListVector<C, T>& in)
+{
+    matmul<PlusTimes<T>>(out, mat, in);
+}
+
+// Sum the per-thread partial outputs of a scatter kernel into out, split
+// over blocks of the output
+template <typename T>
+void reduce_partials(
+    std::vector<T>& out,
+    const std::vector<T>& partials,
+    size_t num_partials,
+    unsigned num_threads)
+{
+    size_t n = out.size();
+    parallel_for(0, n, num_threads,
+        [&](size_t, size_t begin, size_t end) {
+            for (size_t p = 0; p < num_partials; ++p) {
+                const T* partial = partials.data() + p * n;
+                for (size_t i = begin; i < end; ++i) {
+                    out[i] += partial[i];
+                }
+            }
+        });
+}
+
+// Dense vectors, out = mat^T * in without forming the transpose, out is
+// resized to the number of columns. Each thread scatters a range of rows
+// into its own partial output, which costs num_threads * num_cols
+// temporary storage but needs no atomics.
+template <typename C, typename T>
+void matmul_transpose(
+    std::vector<T>& out,
+    const CSRMatrix<C, T>& mat,
+    const std::vector<T>& in,
+    unsigned num_threads = 0)
+{
+    assert(in.size() == mat.num_rows());
+    out.assign(mat.num_cols(), static_cast<T>(0));
+    size_t num_partials = std::min(static_cast<size_t>(resolve_num_threads(num_threads)), mat.num_rows());
+    if (num_partials <= 1) {
+        for (int r = 0, r_end = mat.num_rows(); r < r_end; ++r) {
+            typename std::vector<C>::const_iterator col_begin = mat.crow_begin_col(r);
+            typename std::vector<C>::const_iterator col_end = mat.crow_end_col(r);
+            typename std::vector<T>::const_iterator col_value = mat.crow_begin(r);
+            for (; col_begin != col_end; ++col_begin, ++col_value) {
+                out[*col_begin] += *col_value * in[r];
+            }
+        }
+        return;
+    }
+    std::vector<T> partials(num_partials * mat.num_cols(), static_cast<T>(0));
+    parallel_for(0, mat.num_rows(), num_partials,
+        [&](size_t thread, size_t r_begin, size_t r_end) {
+            T* partial = partials.data() + thread * mat.num_cols();
+            for (size_t r = r_begin; r < r_end; ++r) {
+                typename std::vector<C>::const_iterator col_begin = mat.crow_begin_col(r);
+                typename std::vector<C>::const_iterator col_end = mat.crow_end_col(r);
+                typename std::vector<T>::const_iterator col_value = mat.crow_begin(r);
+                for (; col_begin != col_end; ++col_begin, ++col_value) {
+                    partial[*col_begin] += *col_value * in[r];
+                }
+            }
+        });
+    reduce_partials(out, partials, num_partials, num_threads);
+}
+
+// Dense vectors, out is resized to the number of rows. Scatters columns
+// into per-thread partial outputs like matmul_transpose.
+template <typename C, typename T>
+void matmul(
+    std::vector<T>& out,
+    const CSCMatrix<C, T>& mat,
+    const std::vector<T>& in,
+    unsigned num_threads = 0)
+{
+    assert(in.size() == mat.num_cols());
+    out.assign(mat.num_rows(), static_cast<T>(0));
+    size_t num_partials = std::min(static_cast<size_t>(resolve_num_threads(num_threads)), mat.num_cols());
+    if (num_partials <= 1) {
+        for (int c = 0, c_end = mat.num_cols(); c < c_end; ++c) {
+            typename std::vector<C>::const_iterator row_begin = mat.ccol_begin_row(c);
+            typename std::vector<C>::const_iterator row_end = mat.ccol_end_row(c);
+            typename std::vector<T>::const_iterator row_value = mat.ccol_begin(c);
+            for (; row_begin != row_end; ++row_begin, ++row_value) {
+                out[*row_begin] += *row_value * in[c];
+            }
+        }
+        return;
+    }
+    std::vector<T> partials(num_partials * mat.num_rows(), static_cast<T>(0));
+    parallel_for(0, mat.num_cols(), num_partials,
+        [&](size_t thread, size_t c_begin, size_t c_end) {
+            T* partial = partials.data() + thread * mat.num_rows();
+            for (size_t c = c_begin; c < c_end; ++c) {
+                typename std::vector<C>::const_iterator row_begin = mat.ccol_begin_row(c);
+                typename std::vector<C>::const_iterator row_end = mat.ccol_end_row(c);
+                typename std::vector<T>::const_iterator row_value = mat.ccol_begin(c);
+                for (; row_begin != row_end; ++row_begin, ++row_value) {
+                    partial[*row_begin] += *row_value * in[c];
+                }
+            }
+        });
+    reduce_partials(out, partials, num_partials, num_threads);
+}
+
+// Dense vectors, out = mat * in and out_transpose = mat^T * in_transpose in
+// a single pass over the matrix
+template <typename C, typename T>
+void matmul_fused(
+    std::vector<T>& out,
+    std::vector<T>& out_transpose,
+    const CSRMatrix<C, T>& mat,
+    const std::vector<T>& in,
+    const std::vector<T>& in_transpose,
+    unsigned num_threads = 0)
+{
+    assert(in.size() == mat.num_cols());
+    assert(in_transpose.size() == mat.num_rows());
+    out.assign(mat.num_rows(), static_cast<T>(0));
+    out_transpose.assign(mat.num_cols(), static_cast<T>(0));
+    size_t num_partials = std::min(static_cast<size_t>(resolve_num_threads(num_threads)), mat.num_rows());
+    std::vector<T> partials;
+    if (num_partials > 1) {
+        partials.assign(num_partials * mat.num_cols(), static_cast<T>(0));
+    }
+    parallel_for(0, mat.num_rows(), num_partials,
+        [&](size_t thread, size_t r_begin, size_t r_end) {
+            T* partial = num_partials > 1
+                ? partials.data() + thread * mat.num_cols()
+                : out_transpose.data();
+            for (size_t r = r_begin; r < r_end; ++r) {
+                typename std::vector<C>::const_iterator col_begin = mat.crow_begin_col(r);
+                typename std::vector<C>::const_iterator col_end = mat.crow_end_col(r);
+                typename std::vector<T>::const_iterator col_value = mat.crow_begin(r);
+                T acc = static_cast<T>(0);
+                T scale = in_transpose[r];
+                for (; col_begin != col_end; ++col_begin, ++col_value) {
+                    acc += *col_value * in[*col_begin];
+                    partial[*col_begin] += *col_value * scale;
+                }
+                out[r] = acc;
+            }
+        });
+    if (num_partials > 1) {
+        reduce_partials(out_transpose, partials, num_partials, num_threads);
+    }
+}
+
+// out must be an empty vector
+template <typename C, typename T>
+void matmul(ListVector<C, T>& out, const DynamicCSRMatrix<C, T>& mat, const ListVector<C, T>& in)
+{
+    typedef typename DynamicCSRMatrix<C, T>::Delta Delta;
+    for (int r = 0, r_end = mat.num_rows(); r < r_end; ++r) {
+        typename std::vector<C>::const_iterator col_begin = mat.base().crow_begin_col(r);
+        typename std::vector<C>::const_iterator col_end = mat.base().crow_end_col(r);
+        typename std::vector<T>::const_iterator col_value = mat.base().crow_begin(r);
+        typename std::vector<Delta>::const_iterator delta_begin = mat.crow_begin_delta(r);
+        typename std::vector<Delta>::const_iterator delta_end = mat.crow_end_delta(r);
+        if (col_begin == col_end && delta_begin == delta_end) {
+            // Empty row
+            continue;
+        }
+        T acc = static_cast<T>(0);
+        // Rows whose elements are all removed are empty, as after compact
+        bool live = false;
+        typename std::vector<std::pair<C, T>>::const_iterator in_it = in.cbegin();
+        // Walk the base row and the delta row in column order
+        while ((col_begin != col_end || delta_begin != delta_end) && !(live && in_it == in.cend())) {
+            C c;
+            T v;
+            if (delta_begin == delta_end ||
+                (col_begin != col_end && *col_begin < delta_begin->column)) {
+                c = *col_begin;
+                v = *col_value;
+                ++col_begin;
+                ++col_value;
+            } else {
+                if (col_begin != col_end && *col_begin == delta_begin->column) {
+                    // Delta overrides the base element
+                    ++col_begin;
+                    ++col_value;
+                }
+                bool removed = delta_begin->removed;
+                c = delta_begin->column;
+                v = delta_begin->value;
+                ++delta_begin;
+                if (removed) {
+                    continue;
+                }
+            }
+            live = true;
+            while (in_it != in.cend() && in_it->first < c) {
+                ++in_it;
+            }
+            if (in_it != in.cend() && in_it->first == c) {
+                acc += v * in_it->second;
+            }
+        }
+        if (live) {
+            out.push_back(r, acc);
+        }
+    }
+}
+
+// out must be an empty vector
 template <typename C, typename T>
+void matmul(MapVector<C, T>& out, const DynamicCSRMatrix<C, T>& mat, const MapVector<C, T>& in)
+{
+    typedef typename DynamicCSRMatrix<C, T>::Delta Delta;
+    for (int r = 0, r_end = mat.num_rows(); r < r_end; ++r) {
+        typename std::vector<C>::const_iterator col_begin = mat.base().crow_begin_col(r);
+        typename std::vector<C>::const_iterator col_end = mat.base().crow_end_col(r);
+        typename std::vector<T>::const_iterator col_value = mat.base().crow_begin(r);
+        typename std::vector<Delta>::const_iterator delta_begin = mat.crow_begin_delta(r);
+        typename std::vector<Delta>::const_iterator delta_end = mat.crow_end_delta(r);
+        if (col_begin == col_end && delta_begin == delta_end) {
+            // Empty row
+            continue;
+        }
+        T acc = static_cast<T>(0);
+        // Rows whose elements are all removed are empty, as after compact
+        bool live = false;
+        for (; delta_begin != delta_end; ++delta_begin) {
+            // Base elements before the next delta are unaffected
+            for (; col_begin != col_end && *col_begin < delta_begin->column; ++col_begin, ++col_value) {
+                acc += *col_value * in.get(*col_begin);
+                live = true;
+            }
+            if (col_begin != col_end && *col_begin == delta_begin->column) {
+                ++col_begin;
+                ++col_value;
+            }
+            if (!delta_begin->removed) {
+                acc += delta_begin->value * in.get(delta_begin->column);
+                live = true;
+            }
+        }
+        for (; col_begin != col_end; ++col_begin, ++col_value) {
+            acc += *col_value * in.get(*col_begin);
+            live = true;
+        }
+        if (live) {
+            out.insert(r, acc);
+        }
+    }
+}
+
+// out must be an empty matrix. Output masks for the SpGEMMs are structural,
+// see matmul_masked. Each lhs row scales the stored elements of
+// the rhs rows it selects into a dense row accumulator, so missing rhs
+// elements contribute nothing rather than a literal 0.
+template <typename S, typename C, typename T>
 void matmul(CSRMatrix<C, T>& out, const CSRMatrix<C, T>& lhs, const CSRMatrix<C, T>& rhs)
 {
     assert(lhs.num_cols() == rhs.num_rows());
+    std::vector<T> acc(rhs.num_cols());
     for (int i = 0, i_end = lhs.num_rows(); i < i_end; ++i) {
         out.add_row();
-        for (int j = 0, j_end = rhs.num_cols(); j < j_end; ++j) {
-            typename std::vector<C>::const_iterator col_begin = lhs.crow_begin_col(i);
-            typename std::vector<C>::const_iterator col_end = lhs.crow_end_col(i);
-            typename std::vector<T>::const_iterator col_value = lhs.crow_begin(i);
+        typename std::vector<C>::const_iterator col_begin = lhs.crow_begin_col(i);
+        typename std::vector<C>::const_iterator col_end = lhs.crow_end_col(i);
+        typename std::vector<T>::const_iterator col_value = lhs.crow_begin(i);
 
-            if (col_begin == col_end) {
-                // Empty row
-                continue;
-            }
-            T acc = static_cast<T>(0);
-            for (; col_begin != col_end; ++col_begin, ++col_value) {
-                acc += *col_value * rhs.get(*col_begin, j);
+        if (col_begin == col_end) {
+            // Empty row
+            continue;
+        }
+        std::fill(acc.begin(), acc.end(), S::zero());
+        for (; col_begin != col_end; ++col_begin, ++col_value) {
+            typename std::vector<C>::const_iterator rhs_col_begin = rhs.crow_begin_col(*col_begin);
+            typename std::vector<C>::const_iterator rhs_col_end = rhs.crow_end_col(*col_begin);
+            typename std::vector<T>::const_iterator rhs_col_value = rhs.crow_begin(*col_begin);
+            for (; rhs_col_begin != rhs_col_end; ++rhs_col_begin, ++rhs_col_value) {
+                acc[*rhs_col_begin] = S::add(acc[*rhs_col_begin], S::mul(*col_value, *rhs_col_value));
             }
-            out.push(j, acc);
+        }
+        for (int j = 0, j_end = rhs.num_cols(); j < j_end; ++j) {
+            out.push(j, acc[j]);
         }
     }
 }
 
 // out must be an empty matrix
 template <typename C, typename T>
+void matmul(CSRMatrix<C, T>& out, const CSRMatrix<C, T>& lhs, const CSRMatrix<C, T>& rhs)
+{
+    matmul<PlusTimes<T>>(out, lhs, rhs);
+}
+
+// out must be an empty matrix
+template <typename S, typename C, typename T>
 void matmul(CSRMatrix<C, T>& out, const CSRMatrix<C, T>& lhs, const CSCMatrix<C, T>& rhs)
 {
     assert(lhs.num_cols() == rhs.num_rows());
@@ -104,12 +501,12 @@ void matmul(CSRMatrix<C, T>& out, const CSRMatrix<C, T>& lhs, const CSCMatrix<C,
                 // Empty row
                 continue;
             }
-            T acc = static_cast<T>(0);
+            T acc = S::zero();
             typename std::vector<C>::const_iterator rhs_row_begin = rhs.ccol_begin_row(j);
             typename std::vector<C>::const_iterator rhs_row_end = rhs.ccol_end_row(j);
             typename std::vector<T>::const_iterator rhs_row_value = rhs.ccol_begin(j);
             for (; col_begin != col_end; ++col_begin, ++col_value) {
-                while (*rhs_row_begin < *col_begin) {
+                while (rhs_row_begin != rhs_row_end && *rhs_row_begin < *col_begin) {
                     ++rhs_row_begin;
                     ++rhs_row_value;
                 }
@@ -117,7 +514,7 @@ void matmul(CSRMatrix<C, T>& out, const CSRMatrix<C, T>& lhs, const CSCMatrix<C,
                     break;
                 }
                 if (*rhs_row_begin == *col_begin) {
-                    acc += *col_value * *rhs_row_value;
+                    acc = S::add(acc, S::mul(*col_value, *rhs_row_value));
                 }
             }
             out.push(j, acc);
@@ -125,4 +522,122 @@ void matmul(CSRMatrix<C, T>& out, const CSRMatrix<C, T>& lhs, const CSCMatrix<C,
     }
 }
 
+// out must be an empty matrix
+template <typename C, typename T>
+void matmul(CSRMatrix<C, T>& out, const CSRMatrix<C, T>& lhs, const CSCMatrix<C, T>& rhs)
+{
+    matmul<PlusTimes<T>>(out, lhs, rhs);
+}
+
+// Masked sparse matrix product, out = lhs * rhs evaluated only at the
+// elements of mask, whose values are ignored. out must be an empty matrix
+// and receives the pattern of mask. Mask rows are split over threads.
+template <typename S, typename C, typename T>
+void matmul_masked(
+    CSRMatrix<C, T>& out,
+    const CSRMatrix<C, T>& mask,
+    const CSRMatrix<C, T>& lhs,
+    const CSCMatrix<C, T>& rhs,
+    unsigned num_threads = 0)
+{
+    assert(lhs.num_cols() == rhs.num_rows());
+    assert(mask.num_rows() == lhs.num_rows());
+    assert(mask.num_cols() == rhs.num_cols());
+    assert(out.size() == 0);
+    out = mask;
+    out.unlock_pattern();
+    parallel_for(0, mask.num_rows(), num_threads,
+        [&](size_t, size_t i_begin, size_t i_end) {
+            for (size_t i = i_begin; i < i_end; ++i) {
+                typename std::vector<C>::const_iterator mask_begin = mask.crow_begin_col(i);
+                typename std::vector<C>::const_iterator mask_end = mask.crow_end_col(i);
+                typename std::vector<T>::iterator out_value = out.row_begin(i);
+                for (; mask_begin != mask_end; ++mask_begin, ++out_value) {
+                    typename std::vector<C>::const_iterator col_begin = lhs.crow_begin_col(i);
+                    typename std::vector<C>::const_iterator col_end = lhs.crow_end_col(i);
+                    typename std::vector<T>::const_iterator col_value = lhs.crow_begin(i);
+                    typename std::vector<C>::const_iterator rhs_row_begin = rhs.ccol_begin_row(*mask_begin);
+                    typename std::vector<C>::const_iterator rhs_row_end = rhs.ccol_end_row(*mask_begin);
+                    typename std::vector<T>::const_iterator rhs_row_value = rhs.ccol_begin(*mask_begin);
+                    T acc = S::zero();
+                    while (col_begin != col_end && rhs_row_begin != rhs_row_end) {
+                        if (*col_begin < *rhs_row_begin) {
+                            ++col_begin;
+                            ++col_value;
+                        } else if (*rhs_row_begin < *col_begin) {
+                            ++rhs_row_begin;
+                            ++rhs_row_value;
+                        } else {
+                            acc = S::add(acc, S::mul(*col_value, *rhs_row_value));
+                            ++col_begin;
+                            ++col_value;
+                            ++rhs_row_begin;
+                            ++rhs_row_value;
+                        }
+                    }
+                    *out_value = acc;
+                }
+            }
+        });
+}
+
+// out must be an empty matrix
+template <typename C, typename T>
+void matmul_masked(
+    CSRMatrix<C, T>& out,
+    const CSRMatrix<C, T>& mask,
+    const CSRMatrix<C, T>& lhs,
+    const CSCMatrix<C, T>& rhs,
+    unsigned num_threads = 0)
+{
+    matmul_masked<PlusTimes<T>>(out, mask, lhs, rhs, num_threads);
+}
+
+// Sampled dense-dense product, out(i, j) = mask(i, j) * dot(lhs_i, rhs_j)
+// for the elements of mask only. lhs holds num_rows rows and rhs_transpose
+// holds num_cols rows of inner values each, both row-major, so both operands
+// of every dot product are contiguous. out must be an empty matrix and
+// receives the pattern of mask. Mask rows are split over threads.
+template <typename C, typename T>
+void sddmm(
+    CSRMatrix<C, T>& out,
+    const CSRMatrix<C, T>& mask,
+    const std::vector<T>& lhs,
+    const std::vector<T>& rhs_transpose,
+    size_t inner,
+    unsigned num_threads = 0)
+{
+    assert(lhs.size() == mask.num_rows() * inner);
+    assert(rhs_transpose.size() == mask.num_cols() * inner);
+    assert(out.size() == 0);
+    out = mask;
+    out.unlock_pattern();
+    parallel_for(0, mask.num_rows(), num_threads,
+        [&](size_t, size_t i_begin, size_t i_end) {
+            for (size_t i = i_begin; i < i_end; ++i) {
+                const T* lhs_row = lhs.data() + i * inner;
+                typename std::vector<C>::const_iterator col_begin = mask.crow_begin_col(i);
+                typename std::vector<C>::const_iterator col_end = mask.crow_end_col(i);
+                typename std::vector<T>::iterator out_value = out.row_begin(i);
+                for (; col_begin != col_end; ++col_begin, ++out_value) {
+                    const T* rhs_row = rhs_transpose.data() + static_cast<size_t>(*col_begin) * inner;
+                    // Independent partial sums let the compiler vectorize
+                    // the inner dimension
+                    T acc[4] = {static_cast<T>(0), static_cast<T>(0), static_cast<T>(0), static_cast<T>(0)};
+                    size_t k = 0;
+                    for (; k + 4 <= inner; k += 4) {
+                        acc[0] += lhs_row[k] * rhs_row[k];
+                        acc[1] += lhs_row[k + 1] * rhs_row[k + 1];
+                        acc[2] += lhs_row[k + 2] * rhs_row[k + 2];
+                        acc[3] += lhs_row[k + 3] * rhs_row[k + 3];
+                    }
+                    for (; k < inner; ++k) {
+                        acc[0] += lhs_row[k] * rhs_row[k];
+                    }
+                    *out_value *= (acc[0] + acc[1]) + (acc[2] + acc[3]);
+                }
+            }
+        });
+}
+
 } // namespace sparse
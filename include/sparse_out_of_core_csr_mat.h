@@ -0,0 +1,509 @@
+// sparse_out_of_core_csr_mat.h
+// Copyright Laurence Emms 2020
+
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <limits>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "sparse_csr_mat.h"
+
+namespace sparse {
+
+template <typename C, typename T>
+class OutOfCoreCSRWriter;
+
+// CSR matrix stored on disk as a sequence of row blocks. Only the block
+// table is kept in memory, blocks are streamed in by the operations.
+//
+// File layout, in host byte order:
+//   header:      num_rows, num_cols, nnz, num_blocks (uint64_t)
+//   block table: row_begin, row_end, offset, nnz (uint64_t) per block
+//   blocks:      local row offsets (C[rows + 1]), columns (C[nnz]), values (T[nnz])
+//
+// Blocks follow the table back to back in row order, so they are always
+// read sequentially and no file offset needs to fit in a long.
+template <typename C, typename T>
+class OutOfCoreCSRMatrix {
+public:
+    struct Block {
+        uint64_t row_begin;
+        uint64_t row_end;
+        uint64_t offset;
+        uint64_t nnz;
+    };
+
+    // Resident copy of one block
+    struct BlockBuffer {
+        C row_begin;
+        C row_end;
+        std::vector<C> rows;
+        std::vector<C> columns;
+        std::vector<T> values;
+    };
+
+    static constexpr uint64_t header_size = 4 * sizeof(uint64_t);
+
+private:
+    std::string _path;
+    C _num_rows;
+    C _num_cols;
+    uint64_t _nnz;
+    std::vector<Block> _blocks;
+
+    static uint64_t block_bytes(uint64_t num_rows, uint64_t nnz);
+
+public:
+    OutOfCoreCSRMatrix();
+
+    // Write mat to path in blocks of rows_per_block rows
+    static bool write(const std::string& path, const CSRMatrix<C, T>& mat, const C& rows_per_block);
+
+    // Read and validate the header and block table of a matrix file
+    bool open(const std::string& path);
+
+    // Read past the header and block table of a file opened on path(),
+    // checking that they still match the opened matrix
+    bool seek_blocks(std::FILE* file) const;
+
+    // Read block b from a file opened on path(). The file must be positioned
+    // at the start of the block, as it is after seek_blocks() or after
+    // reading block b - 1.
+    bool read_block(std::FILE* file, size_t b, BlockBuffer& buffer) const;
+
+    const std::string& path() const;
+    size_t num_blocks() const;
+
+    // Number of elements
+    size_t size() const;
+    size_t num_rows() const;
+    size_t num_cols() const;
+};
+
+// Writes an OutOfCoreCSRMatrix file one row at a time. Only the current row
+// block and the block table are held in memory, so matrices larger than
+// memory can be written. The table is patched in by finish().
+template <typename C, typename T>
+class OutOfCoreCSRWriter {
+    typedef typename OutOfCoreCSRMatrix<C, T>::Block Block;
+
+    std::FILE* _file;
+    bool _ok;
+    C _num_rows;
+    C _num_cols;
+    C _rows_per_block;
+    C _rows_written;
+    uint64_t _nnz;
+    uint64_t _offset;
+    std::vector<Block> _blocks;
+    std::vector<C> _block_rows;
+    std::vector<C> _block_columns;
+    std::vector<T> _block_values;
+
+    bool flush_block();
+
+public:
+    OutOfCoreCSRWriter();
+    ~OutOfCoreCSRWriter();
+
+    OutOfCoreCSRWriter(const OutOfCoreCSRWriter&) = delete;
+    OutOfCoreCSRWriter& operator=(const OutOfCoreCSRWriter&) = delete;
+
+    // Create path for a num_rows x num_cols matrix
+    bool begin(const std::string& path, const C& num_rows, const C& num_cols, const C& rows_per_block);
+
+    // Append the next row, as CSRMatrix::push_back_row
+    bool append_row(const std::vector<C>& columns, const std::vector<T>& values);
+
+    // Flush the last block and write the block table. All num_rows rows
+    // must have been appended.
+    bool finish();
+};
+
+template <typename C, typename T>
+OutOfCoreCSRMatrix<C, T>::OutOfCoreCSRMatrix() :
+    _num_rows(0),
+    _num_cols(0),
+    _nnz(0)
+{
+}
+
+template <typename C, typename T>
+uint64_t OutOfCoreCSRMatrix<C, T>::block_bytes(uint64_t num_rows, uint64_t nnz)
+{
+    return (num_rows + 1 + nnz) * sizeof(C) + nnz * sizeof(T);
+}
+
+template <typename C, typename T>
+bool OutOfCoreCSRMatrix<C, T>::write(
+    const std::string& path,
+    const CSRMatrix<C, T>& mat,
+    const C& rows_per_block)
+{
+    OutOfCoreCSRWriter<C, T> writer;
+    if (!writer.begin(path, mat.num_rows(), mat.num_cols(), rows_per_block)) {
+        return false;
+    }
+    std::vector<C> columns;
+    std::vector<T> values;
+    for (C r = 0; r < static_cast<C>(mat.num_rows()); ++r) {
+        columns.assign(mat.crow_begin_col(r), mat.crow_end_col(r));
+        values.assign(mat.crow_begin(r), mat.crow_end(r));
+        if (!writer.append_row(columns, values)) {
+            return false;
+        }
+    }
+    return writer.finish();
+}
+
+template <typename C, typename T>
+bool OutOfCoreCSRMatrix<C, T>::open(const std::string& path)
+{
+    std::error_code error;
+    uint64_t file_size = std::filesystem::file_size(path, error);
+    if (error) {
+        return false;
+    }
+    std::FILE* file = std::fopen(path.c_str(), "rb");
+    if (!file) {
+        return false;
+    }
+    uint64_t header[4] = {0, 0, 0, 0};
+    bool ok = std::fread(header, sizeof(header), 1, file) == 1
+        && header[0] <= static_cast<uint64_t>(std::numeric_limits<C>::max())
+        && header[1] <= static_cast<uint64_t>(std::numeric_limits<C>::max())
+        // Every block holds at least one row
+        && header[3] <= header[0]
+        && (header[0] == 0 || header[3] > 0)
+        && header[3] <= (file_size - header_size) / sizeof(Block);
+    // The table is read one entry at a time, so a corrupt block count fails
+    // at the end of the file instead of allocating up front
+    std::vector<Block> blocks;
+    uint64_t row_end = 0;
+    uint64_t nnz = 0;
+    uint64_t offset = header_size + header[3] * sizeof(Block);
+    for (uint64_t b = 0; ok && b < header[3]; ++b) {
+        Block block;
+        ok = std::fread(&block, sizeof(Block), 1, file) == 1
+            && block.row_begin == row_end
+            && block.row_end > block.row_begin
+            && block.row_end <= header[0]
+            && block.offset == offset
+            && block.nnz <= file_size;
+        if (ok) {
+            blocks.push_back(block);
+            row_end = block.row_end;
+            nnz += block.nnz;
+            offset += block_bytes(block.row_end - block.row_begin, block.nnz);
+        }
+    }
+    std::fclose(file);
+    // The blocks must exactly fill the rest of the file
+    if (!ok || row_end != header[0] || nnz != header[2] || offset != file_size) {
+        return false;
+    }
+    _path = path;
+    _num_rows = static_cast<C>(header[0]);
+    _num_cols = static_cast<C>(header[1]);
+    _nnz = header[2];
+    _blocks.swap(blocks);
+    return true;
+}
+
+template <typename C, typename T>
+bool OutOfCoreCSRMatrix<C, T>::seek_blocks(std::FILE* file) const
+{
+    uint64_t header[4];
+    if (std::fread(header, sizeof(header), 1, file) != 1
+        || header[0] != static_cast<uint64_t>(_num_rows)
+        || header[1] != static_cast<uint64_t>(_num_cols)
+        || header[2] != _nnz
+        || header[3] != _blocks.size()) {
+        return false;
+    }
+    for (size_t b = 0; b < _blocks.size(); ++b) {
+        Block block;
+        if (std::fread(&block, sizeof(Block), 1, file) != 1
+            || block.row_begin != _blocks[b].row_begin
+            || block.row_end != _blocks[b].row_end
+            || block.offset != _blocks[b].offset
+            || block.nnz != _blocks[b].nnz) {
+            return false;
+        }
+    }
+    return true;
+}
+
+template <typename C, typename T>
+bool OutOfCoreCSRMatrix<C, T>::read_block(std::FILE* file, size_t b, BlockBuffer& buffer) const
+{
+    const Block& block = _blocks[b];
+    size_t num_rows = block.row_end - block.row_begin;
+    buffer.row_begin = static_cast<C>(block.row_begin);
+    buffer.row_end = static_cast<C>(block.row_end);
+    // Buffers only grow, so steady state streaming does not allocate
+    buffer.rows.resize(num_rows + 1);
+    buffer.columns.resize(block.nnz);
+    buffer.values.resize(block.nnz);
+    if (std::fread(buffer.rows.data(), sizeof(C), num_rows + 1, file) != num_rows + 1
+        || (block.nnz > 0 &&
+            (std::fread(buffer.columns.data(), sizeof(C), block.nnz, file) != block.nnz
+             || std::fread(buffer.values.data(), sizeof(T), block.nnz, file) != block.nnz))) {
+        return false;
+    }
+    // Reject blocks which would index outside the buffers or the input
+    if (buffer.rows[0] != 0 || static_cast<uint64_t>(buffer.rows[num_rows]) != block.nnz) {
+        return false;
+    }
+    for (size_t r = 0; r < num_rows; ++r) {
+        if (buffer.rows[r + 1] < buffer.rows[r]) {
+            return false;
+        }
+    }
+    for (const C& c : buffer.columns) {
+        if (c < 0 || c >= _num_cols) {
+            return false;
+        }
+    }
+    return true;
+}
+
+template <typename C, typename T>
+OutOfCoreCSRWriter<C, T>::OutOfCoreCSRWriter() :
+    _file(nullptr),
+    _ok(false),
+    _num_rows(0),
+    _num_cols(0),
+    _rows_per_block(0),
+    _rows_written(0),
+    _nnz(0),
+    _offset(0)
+{
+}
+
+// An unfinished file is closed but left incomplete
+template <typename C, typename T>
+OutOfCoreCSRWriter<C, T>::~OutOfCoreCSRWriter()
+{
+    if (_file) {
+        std::fclose(_file);
+    }
+}
+
+template <typename C, typename T>
+bool OutOfCoreCSRWriter<C, T>::begin(
+    const std::string& path,
+    const C& num_rows,
+    const C& num_cols,
+    const C& rows_per_block)
+{
+    assert(!_file);
+    assert(rows_per_block > 0);
+    _file = std::fopen(path.c_str(), "wb");
+    if (!_file) {
+        return false;
+    }
+    _num_rows = num_rows;
+    _num_cols = num_cols;
+    _rows_per_block = rows_per_block;
+    _rows_written = 0;
+    _nnz = 0;
+    _blocks.clear();
+    _block_rows.assign(1, static_cast<C>(0));
+    _block_columns.clear();
+    _block_values.clear();
+
+    // Placeholder header and table, patched by finish
+    size_t num_blocks = (static_cast<size_t>(num_rows) + rows_per_block - 1) / rows_per_block;
+    uint64_t header[4] = {0, 0, 0, 0};
+    Block empty = {0, 0, 0, 0};
+    _ok = std::fwrite(header, sizeof(header), 1, _file) == 1;
+    for (size_t b = 0; _ok && b < num_blocks; ++b) {
+        _ok = std::fwrite(&empty, sizeof(Block), 1, _file) == 1;
+    }
+    _offset = OutOfCoreCSRMatrix<C, T>::header_size + num_blocks * sizeof(Block);
+    return _ok;
+}
+
+template <typename C, typename T>
+bool OutOfCoreCSRWriter<C, T>::append_row(const std::vector<C>& columns, const std::vector<T>& values)
+{
+    assert(_file);
+    assert(columns.size() == values.size());
+    assert(_rows_written < _num_rows);
+    if (!_ok) {
+        return false;
+    }
+    _block_columns.insert(_block_columns.end(), columns.begin(), columns.end());
+    _block_values.insert(_block_values.end(), values.begin(), values.end());
+    _block_rows.push_back(static_cast<C>(_block_columns.size()));
+    ++_rows_written;
+    if (_block_rows.size() == static_cast<size_t>(_rows_per_block) + 1) {
+        _ok = flush_block();
+    }
+    return _ok;
+}
+
+template <typename C, typename T>
+bool OutOfCoreCSRWriter<C, T>::flush_block()
+{
+    Block block;
+    block.row_end = _rows_written;
+    block.row_begin = _rows_written - (_block_rows.size() - 1);
+    block.offset = _offset;
+    block.nnz = _block_columns.size();
+    bool ok = std::fwrite(_block_rows.data(), sizeof(C), _block_rows.size(), _file) == _block_rows.size()
+        && (block.nnz == 0 ||
+            (std::fwrite(_block_columns.data(), sizeof(C), block.nnz, _file) == block.nnz
+             && std::fwrite(_block_values.data(), sizeof(T), block.nnz, _file) == block.nnz));
+    _blocks.push_back(block);
+    _offset += (_block_rows.size() + block.nnz) * sizeof(C) + block.nnz * sizeof(T);
+    _nnz += block.nnz;
+    _block_rows.assign(1, static_cast<C>(0));
+    _block_columns.clear();
+    _block_values.clear();
+    return ok;
+}
+
+template <typename C, typename T>
+bool OutOfCoreCSRWriter<C, T>::finish()
+{
+    assert(_file);
+    if (_ok && _block_rows.size() > 1) {
+        _ok = flush_block();
+    }
+    _ok = _ok && _rows_written == _num_rows;
+    uint64_t header[4] = {
+        static_cast<uint64_t>(_num_rows),
+        static_cast<uint64_t>(_num_cols),
+        _nnz,
+        _blocks.size()};
+    _ok = _ok
+        && std::fseek(_file, 0, SEEK_SET) == 0
+        && std::fwrite(header, sizeof(header), 1, _file) == 1
+        && (_blocks.empty() ||
+            std::fwrite(_blocks.data(), sizeof(Block), _blocks.size(), _file) == _blocks.size());
+    bool closed = std::fclose(_file) == 0;
+    _file = nullptr;
+    return _ok && closed;
+}
+
+template <typename C, typename T>
+const std::string& OutOfCoreCSRMatrix<C, T>::path() const
+{
+    return _path;
+}
+
+template <typename C, typename T>
+size_t OutOfCoreCSRMatrix<C, T>::num_blocks() const
+{
+    return _blocks.size();
+}
+
+template <typename C, typename T>
+size_t OutOfCoreCSRMatrix<C, T>::size() const
+{
+    return _nnz;
+}
+
+template <typename C, typename T>
+size_t OutOfCoreCSRMatrix<C, T>::num_rows() const
+{
+    return _num_rows;
+}
+
+template <typename C, typename T>
+size_t OutOfCoreCSRMatrix<C, T>::num_cols() const
+{
+    return _num_cols;
+}
+
+// Dense vectors, out is resized to the number of rows. Blocks are read in
+// file order by a reader thread into one of two buffers while the other is
+// multiplied, so at most two blocks are resident. Returns false on I/O error.
+template <typename C, typename T>
+bool matmul(std::vector<T>& out, const OutOfCoreCSRMatrix<C, T>& mat, const std::vector<T>& in)
+{
+    typedef typename OutOfCoreCSRMatrix<C, T>::BlockBuffer BlockBuffer;
+    assert(in.size() == mat.num_cols());
+    out.assign(mat.num_rows(), static_cast<T>(0));
+    if (mat.num_blocks() == 0) {
+        return true;
+    }
+    std::FILE* file = std::fopen(mat.path().c_str(), "rb");
+    if (!file) {
+        return false;
+    }
+    if (!mat.seek_blocks(file)) {
+        std::fclose(file);
+        return false;
+    }
+
+    BlockBuffer buffers[2];
+    bool ready[2] = {false, false};
+    bool failed = false;
+    std::mutex mutex;
+    std::condition_variable condition;
+
+    std::thread reader([&]() {
+        for (size_t b = 0; b < mat.num_blocks(); ++b) {
+            size_t slot = b % 2;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                condition.wait(lock, [&]() { return !ready[slot]; });
+            }
+            bool ok = mat.read_block(file, b, buffers[slot]);
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (!ok) {
+                    failed = true;
+                } else {
+                    ready[slot] = true;
+                }
+            }
+            condition.notify_all();
+            if (!ok) {
+                return;
+            }
+        }
+    });
+
+    for (size_t b = 0; b < mat.num_blocks(); ++b) {
+        size_t slot = b % 2;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            condition.wait(lock, [&]() { return ready[slot] || failed; });
+            if (!ready[slot]) {
+                break;
+            }
+        }
+        const BlockBuffer& buffer = buffers[slot];
+        for (C r = 0, r_end = buffer.row_end - buffer.row_begin; r < r_end; ++r) {
+            T acc = static_cast<T>(0);
+            for (C k = buffer.rows[r]; k < buffer.rows[r + 1]; ++k) {
+                acc += buffer.values[k] * in[buffer.columns[k]];
+            }
+            out[buffer.row_begin + r] = acc;
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            ready[slot] = false;
+        }
+        condition.notify_all();
+    }
+
+    reader.join();
+    std::fclose(file);
+    return !failed;
+}
+
+} // namespace sparse
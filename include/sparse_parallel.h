@@ -0,0 +1,49 @@
+// sparse_parallel.h
+// Copyright Laurence Emms 2020
+
+#pragma once
+
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+namespace sparse {
+
+// Number of worker threads to use, zero selects the hardware concurrency
+inline unsigned resolve_num_threads(unsigned num_threads)
+{
+    if (num_threads == 0) {
+        num_threads = std::thread::hardware_concurrency();
+    }
+    return std::max(num_threads, 1u);
+}
+
+// Split [begin, end) into one contiguous chunk per thread and call
+// fn(thread, chunk_begin, chunk_end) for each chunk. The calling thread
+// processes the first chunk.
+template <typename F>
+void parallel_for(size_t begin, size_t end, unsigned num_threads, F fn)
+{
+    if (begin >= end) {
+        return;
+    }
+    size_t count = end - begin;
+    size_t chunks = std::min(static_cast<size_t>(resolve_num_threads(num_threads)), count);
+    size_t chunk_size = (count + chunks - 1) / chunks;
+    std::vector<std::thread> threads;
+    threads.reserve(chunks - 1);
+    for (size_t t = 1; t < chunks; ++t) {
+        size_t chunk_begin = begin + t * chunk_size;
+        size_t chunk_end = std::min(chunk_begin + chunk_size, end);
+        if (chunk_begin >= chunk_end) {
+            break;
+        }
+        threads.emplace_back(fn, t, chunk_begin, chunk_end);
+    }
+    fn(static_cast<size_t>(0), begin, std::min(begin + chunk_size, end));
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+}
+
+} // namespace sparse
@@ -0,0 +1,139 @@
+// sparse_scatter_map.h
+// Copyright Laurence Emms 2020
+
+#pragma once
+
+#include <cassert>
+#include <stdexcept>
+#include <vector>
+
+#include "sparse_csr_mat.h"
+#include "sparse_parallel.h"
+
+namespace sparse {
+
+// Precomputed map from unordered (row, column) contributions to the value
+// slots of a fixed CSR pattern. The map is stored inverted, as the list of
+// contributions for each slot, so a refill can be split over slots without
+// two threads writing the same value.
+template <typename C>
+class ScatterMap {
+    size_t _num_triplets;
+    std::vector<size_t> _slot_offsets;
+    std::vector<size_t> _triplets;
+
+public:
+    // Every (rows[k], cols[k]) must be present in the pattern of mat,
+    // otherwise std::out_of_range is thrown
+    template <typename T>
+    ScatterMap(
+        const CSRMatrix<C, T>& mat,
+        const std::vector<C>& rows,
+        const std::vector<C>& cols);
+
+    typename std::vector<size_t>::const_iterator slot_begin_triplet(const size_t& s) const;
+    typename std::vector<size_t>::const_iterator slot_end_triplet(const size_t& s) const;
+
+    size_t num_triplets() const;
+    size_t num_slots() const;
+};
+
+template <typename C>
+template <typename T>
+ScatterMap<C>::ScatterMap(
+    const CSRMatrix<C, T>& mat,
+    const std::vector<C>& rows,
+    const std::vector<C>& cols) :
+    _num_triplets(rows.size()),
+    _slot_offsets(mat.size() + 1, 0),
+    _triplets(rows.size())
+{
+    if (rows.size() != cols.size()) {
+        throw std::invalid_argument("ScatterMap: rows and cols differ in size");
+    }
+    std::vector<size_t> slots(_num_triplets);
+    typename std::vector<C>::const_iterator columns_begin =
+        mat.size() > 0 ? mat.crow_begin_col(0) : typename std::vector<C>::const_iterator();
+    for (size_t k = 0; k < _num_triplets; ++k) {
+        if (rows[k] < 0 || rows[k] >= static_cast<C>(mat.num_rows())) {
+            throw std::out_of_range("ScatterMap: row outside of matrix");
+        }
+        typename std::vector<C>::const_iterator col_begin = mat.crow_begin_col(rows[k]);
+        typename std::vector<C>::const_iterator col_end = mat.crow_end_col(rows[k]);
+        // Linear search in the row, patterns need not be sorted
+        for (; col_begin != col_end && *col_begin != cols[k]; ++col_begin) {
+        }
+        if (col_begin == col_end) {
+            throw std::out_of_range("ScatterMap: element not in matrix pattern");
+        }
+        slots[k] = col_begin - columns_begin;
+        ++_slot_offsets[slots[k] + 1];
+    }
+    // Counting sort of the triplets by slot
+    for (size_t s = 0; s < mat.size(); ++s) {
+        _slot_offsets[s + 1] += _slot_offsets[s];
+    }
+    std::vector<size_t> next(_slot_offsets.begin(), _slot_offsets.end() - 1);
+    for (size_t k = 0; k < _num_triplets; ++k) {
+        _triplets[next[slots[k]]++] = k;
+    }
+}
+
+template <typename C>
+typename std::vector<size_t>::const_iterator
+ScatterMap<C>::slot_begin_triplet(const size_t& s) const
+{
+    return _triplets.cbegin() + _slot_offsets[s];
+}
+
+template <typename C>
+typename std::vector<size_t>::const_iterator
+ScatterMap<C>::slot_end_triplet(const size_t& s) const
+{
+    return _triplets.cbegin() + _slot_offsets[s + 1];
+}
+
+template <typename C>
+size_t ScatterMap<C>::num_triplets() const
+{
+    return _num_triplets;
+}
+
+template <typename C>
+size_t ScatterMap<C>::num_slots() const
+{
+    return _slot_offsets.size() - 1;
+}
+
+// Overwrite the values of a locked matrix with the summed contributions.
+// contributions[k] belongs to the k-th (row, column) pair the map was built
+// from. Slots without contributions are set to zero. The index arrays are
+// not touched and nothing is reallocated.
+template <typename C, typename T>
+void refill(
+    CSRMatrix<C, T>& mat,
+    const ScatterMap<C>& map,
+    const std::vector<T>& contributions,
+    unsigned num_threads = 0)
+{
+    assert(mat.pattern_locked());
+    assert(map.num_slots() == mat.size());
+    assert(contributions.size() == map.num_triplets());
+    if (map.num_slots() == 0) {
+        return;
+    }
+    typename std::vector<T>::iterator values = mat.row_begin(0);
+    parallel_for(0, map.num_slots(), num_threads,
+        [&](size_t, size_t slot_begin, size_t slot_end) {
+            for (size_t s = slot_begin; s < slot_end; ++s) {
+                T acc = static_cast<T>(0);
+                for (typename std::vector<size_t>::const_iterator it = map.slot_begin_triplet(s);
+                     it != map.slot_end_triplet(s); ++it) {
+                    acc += contributions[*it];
+                }
+                values[s] = acc;
+            }
+        });
+}
+
+} // namespace sparse
@@ -0,0 +1,61 @@
+// sparse_semiring.h
+// Copyright Laurence Emms 2020
+
+#pragma once
+
+#include <algorithm>
+#include <limits>
+
+namespace sparse {
+
+// Semirings for the matmul kernels. Each provides the additive identity
+// zero(), the operations add() and mul(), and terminal(), which is true when
+// an accumulated value can no longer change under add() so a kernel may
+// stop accumulating early.
+
+// Conventional arithmetic
+template <typename T>
+struct PlusTimes {
+    static T zero() {return static_cast<T>(0);}
+    static T add(const T& a, const T& b) {return a + b;}
+    static T mul(const T& a, const T& b) {return a * b;}
+    static bool terminal(const T&) {return false;}
+};
+
+// Shortest paths, zero() is infinity or the largest finite value
+template <typename T>
+struct MinPlus {
+    static T zero()
+    {
+        return std::numeric_limits<T>::has_infinity
+            ? std::numeric_limits<T>::infinity()
+            : std::numeric_limits<T>::max();
+    }
+    static T add(const T& a, const T& b) {return std::min(a, b);}
+    static T mul(const T& a, const T& b)
+    {
+        // Avoid overflow of the largest finite value
+        return (a == zero() || b == zero()) ? zero() : a + b;
+    }
+    static bool terminal(const T&) {return false;}
+};
+
+// Reachability, any non-zero value is true
+template <typename T>
+struct OrAnd {
+    static T zero() {return static_cast<T>(0);}
+    static T add(const T& a, const T& b) {return static_cast<T>(a != zero() || b != zero());}
+    static T mul(const T& a, const T& b) {return static_cast<T>(a != zero() && b != zero());}
+    static bool terminal(const T& a) {return a != zero();}
+};
+
+// Most probable paths, values must be non-negative
+template <typename T>
+struct MaxTimes {
+    static T zero() {return static_cast<T>(0);}
+    static T add(const T& a, const T& b) {return std::max(a, b);}
+    static T mul(const T& a, const T& b) {return a * b;}
+    static bool terminal(const T&) {return false;}
+};
+
+} // namespace sparse
@@ -1,13 +1,24 @@
 // test.cpp
 // Copyright Laurence Emms 2020
 
+#include <cstdint>
+#include <cstdio>
+#include <limits>
 #include <iostream>
+#include <stdexcept>
+#include <vector>
 
+#include "sparse_autotune.h"
 #include "sparse_csc_mat.h"
 #include "sparse_csr_mat.h"
+#include "sparse_dynamic_csr_mat.h"
+#include "sparse_graph.h"
 #include "sparse_list_vector.h"
 #include "sparse_map_vector.h"
 #include "sparse_mat_operations.h"
+#include "sparse_out_of_core_csr_mat.h"
+#include "sparse_scatter_map.h"
+#include "sparse_semiring.h"
 
 int main(int argc, char** argv) {
     std::cout << "Test Sparse Linear Algebra Library." << std::endl;
@@ -80,6 +91,162 @@ int main(int argc, char** argv) {
         << map_mul_vector.get(2) << ", "
         << map_mul_vector.get(3) << std::endl;
 
+    sparse::DynamicCSRMatrix<int, float> dynamic_matrix(csr_matrix, 4);
+
+    dynamic_matrix.insert(0, 3, 5.0f);
+    dynamic_matrix.insert(2, 0, 6.0f);
+    dynamic_matrix.remove(1, 1);
+
+    std::cout << "Dynamic Matrix (" << dynamic_matrix.num_pending() << " pending):" << std::endl;
+    std::cout << dynamic_matrix.get(0, 0) << ", "
+        << dynamic_matrix.get(0, 1) << ", "
+        << dynamic_matrix.get(0, 2) << ", "
+        << dynamic_matrix.get(0, 3) << std::endl;
+    std::cout << dynamic_matrix.get(1, 0) << ", "
+        << dynamic_matrix.get(1, 1) << ", "
+        << dynamic_matrix.get(1, 2) << ", "
+        << dynamic_matrix.get(1, 3) << std::endl;
+    std::cout << dynamic_matrix.get(2, 0) << ", "
+        << dynamic_matrix.get(2, 1) << ", "
+        << dynamic_matrix.get(2, 2) << ", "
+        << dynamic_matrix.get(2, 3) << std::endl;
+    std::cout << dynamic_matrix.get(3, 0) << ", "
+        << dynamic_matrix.get(3, 1) << ", "
+        << dynamic_matrix.get(3, 2) << ", "
+        << dynamic_matrix.get(3, 3) << std::endl;
+
+    sparse::ListVector<int, float> dynamic_list_mul_vector;
+
+    sparse::matmul(dynamic_list_mul_vector, dynamic_matrix, list_vector);
+
+    std::cout << "Dynamic List mul Vector: "
+        << dynamic_list_mul_vector.get(0) << ", "
+        << dynamic_list_mul_vector.get(1) << ", "
+        << dynamic_list_mul_vector.get(2) << ", "
+        << dynamic_list_mul_vector.get(3) << std::endl;
+
+    sparse::MapVector<int, float> dynamic_map_mul_vector;
+
+    sparse::matmul(dynamic_map_mul_vector, dynamic_matrix, map_vector);
+
+    std::cout << "Dynamic Map mul Vector: "
+        << dynamic_map_mul_vector.get(0) << ", "
+        << dynamic_map_mul_vector.get(1) << ", "
+        << dynamic_map_mul_vector.get(2) << ", "
+        << dynamic_map_mul_vector.get(3) << std::endl;
+
+    // Removed elements take no part in products, before or after compaction
+    sparse::DynamicCSRMatrix<int, float> tombstone_matrix(csr_matrix, 0);
+    tombstone_matrix.remove(1, 1);
+    sparse::ListVector<int, float> infinite_vector;
+    infinite_vector.push_back(1, std::numeric_limits<float>::infinity());
+    sparse::MapVector<int, float> infinite_map_vector;
+    infinite_map_vector.insert(1, std::numeric_limits<float>::infinity());
+
+    for (int pass = 0; pass < 2; ++pass) {
+        sparse::ListVector<int, float> tombstone_list_out;
+        sparse::MapVector<int, float> tombstone_map_out;
+        sparse::matmul(tombstone_list_out, tombstone_matrix, infinite_vector);
+        sparse::matmul(tombstone_map_out, tombstone_matrix, infinite_map_vector);
+        std::cout << (pass == 0 ? "Pending" : "Compacted") << " Tombstone mul Infinite Vector ("
+            << tombstone_list_out.size() << " elements): "
+            << tombstone_list_out.get(0) << ", "
+            << tombstone_list_out.get(1) << ", "
+            << tombstone_list_out.get(2) << ", "
+            << tombstone_list_out.get(3) << "; Map Row 1: "
+            << tombstone_map_out.get(1) << std::endl;
+        tombstone_matrix.compact();
+    }
+
+    // Crosses the merge threshold
+    dynamic_matrix.insert(3, 0, 7.0f);
+
+    std::cout << "Compacted Dynamic Matrix (" << dynamic_matrix.num_pending() << " pending, "
+        << dynamic_matrix.base().size() << " elements):" << std::endl;
+    std::cout << dynamic_matrix.get(0, 0) << ", "
+        << dynamic_matrix.get(0, 1) << ", "
+        << dynamic_matrix.get(0, 2) << ", "
+        << dynamic_matrix.get(0, 3) << std::endl;
+    std::cout << dynamic_matrix.get(1, 0) << ", "
+        << dynamic_matrix.get(1, 1) << ", "
+        << dynamic_matrix.get(1, 2) << ", "
+        << dynamic_matrix.get(1, 3) << std::endl;
+    std::cout << dynamic_matrix.get(2, 0) << ", "
+        << dynamic_matrix.get(2, 1) << ", "
+        << dynamic_matrix.get(2, 2) << ", "
+        << dynamic_matrix.get(2, 3) << std::endl;
+    std::cout << dynamic_matrix.get(3, 0) << ", "
+        << dynamic_matrix.get(3, 1) << ", "
+        << dynamic_matrix.get(3, 2) << ", "
+        << dynamic_matrix.get(3, 3) << std::endl;
+
+    sparse::CSRMatrix<int, float> assembly_matrix(4, 4);
+
+    assembly_matrix.push_back_row({0, 1}, {0.0f, 0.0f});
+    assembly_matrix.push_back_row({0, 1, 2}, {0.0f, 0.0f, 0.0f});
+    assembly_matrix.push_back_row({1, 2, 3}, {0.0f, 0.0f, 0.0f});
+    assembly_matrix.push_back_row({2, 3}, {0.0f, 0.0f});
+    assembly_matrix.lock_pattern();
+
+    // Three 2x2 element stiffness matrices sharing their end nodes
+    std::vector<int> assembly_rows = {0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3};
+    std::vector<int> assembly_cols = {0, 1, 0, 1, 1, 2, 1, 2, 2, 3, 2, 3};
+    sparse::ScatterMap<int> scatter_map(assembly_matrix, assembly_rows, assembly_cols);
+    std::vector<float> contributions = {1.0f, -1.0f, -1.0f, 1.0f,
+                                        1.0f, -1.0f, -1.0f, 1.0f,
+                                        1.0f, -1.0f, -1.0f, 1.0f};
+
+    sparse::refill(assembly_matrix, scatter_map, contributions);
+
+    try {
+        sparse::ScatterMap<int> bad_scatter_map(assembly_matrix, {0}, {3});
+        std::cout << "Scatter Map outside Pattern: accepted" << std::endl;
+    } catch (const std::out_of_range& e) {
+        std::cout << "Scatter Map outside Pattern: " << e.what() << std::endl;
+    }
+
+
+    std::cout << "Refilled Matrix:" << std::endl;
+    std::cout << assembly_matrix.get(0, 0) << ", "
+        << assembly_matrix.get(0, 1) << ", "
+        << assembly_matrix.get(0, 2) << ", "
+        << assembly_matrix.get(0, 3) << std::endl;
+    std::cout << assembly_matrix.get(1, 0) << ", "
+        << assembly_matrix.get(1, 1) << ", "
+        << assembly_matrix.get(1, 2) << ", "
+        << assembly_matrix.get(1, 3) << std::endl;
+    std::cout << assembly_matrix.get(2, 0) << ", "
+        << assembly_matrix.get(2, 1) << ", "
+        << assembly_matrix.get(2, 2) << ", "
+        << assembly_matrix.get(2, 3) << std::endl;
+    std::cout << assembly_matrix.get(3, 0) << ", "
+        << assembly_matrix.get(3, 1) << ", "
+        << assembly_matrix.get(3, 2) << ", "
+        << assembly_matrix.get(3, 3) << std::endl;
+
+    for (float& contribution : contributions) {
+        contribution *= 2.0f;
+    }
+    sparse::refill(assembly_matrix, scatter_map, contributions, 2);
+
+    std::cout << "Refilled Matrix (2 threads):" << std::endl;
+    std::cout << assembly_matrix.get(0, 0) << ", "
+        << assembly_matrix.get(0, 1) << ", "
+        << assembly_matrix.get(0, 2) << ", "
+        << assembly_matrix.get(0, 3) << std::endl;
+    std::cout << assembly_matrix.get(1, 0) << ", "
+        << assembly_matrix.get(1, 1) << ", "
+        << assembly_matrix.get(1, 2) << ", "
+        << assembly_matrix.get(1, 3) << std::endl;
+    std::cout << assembly_matrix.get(2, 0) << ", "
+        << assembly_matrix.get(2, 1) << ", "
+        << assembly_matrix.get(2, 2) << ", "
+        << assembly_matrix.get(2, 3) << std::endl;
+    std::cout << assembly_matrix.get(3, 0) << ", "
+        << assembly_matrix.get(3, 1) << ", "
+        << assembly_matrix.get(3, 2) << ", "
+        << assembly_matrix.get(3, 3) << std::endl;
+
     sparse::CSRMatrix<int, float> mul_matrix(4, 4);
 
     mul_matrix.push_back_row({0, 1, 2, 3}, {1.0f, 2.0f, 3.0f, 4.0f});
@@ -105,6 +272,116 @@ int main(int argc, char** argv) {
         << mul_matrix.get(3, 2) << ", "
         << mul_matrix.get(3, 3) << std::endl;
 
+    sparse::TuningCache tuning_cache;
+    std::vector<float> dense_vector = {1.0f, 2.0f, 3.0f, 4.0f};
+    const char* format_names[] = {"CSR", "ELL", "BCSR"};
+
+    sparse::TunedOperator<int, float> tuned_diagonal = sparse::tune(csr_matrix, false, &tuning_cache);
+    sparse::TunedOperator<int, float> tuned_dense = sparse::tune(mul_matrix, false, &tuning_cache);
+    sparse::TunedOperator<int, float> tuned_benchmark = sparse::tune(mul_matrix, true);
+    std::vector<float> tuned_out;
+
+    tuned_diagonal.apply(tuned_out, dense_vector);
+    std::cout << "Tuned Diagonal (" << format_names[static_cast<int>(tuned_diagonal.format())] << ") mul Vector: "
+        << tuned_out[0] << ", "
+        << tuned_out[1] << ", "
+        << tuned_out[2] << ", "
+        << tuned_out[3] << std::endl;
+
+    tuned_dense.apply(tuned_out, dense_vector);
+    std::cout << "Tuned Mul Matrix (" << format_names[static_cast<int>(tuned_dense.format())] << ") mul Vector: "
+        << tuned_out[0] << ", "
+        << tuned_out[1] << ", "
+        << tuned_out[2] << ", "
+        << tuned_out[3] << std::endl;
+
+    tuned_benchmark.apply(tuned_out, dense_vector);
+    std::cout << "Benchmarked Mul Matrix mul Vector: "
+        << tuned_out[0] << ", "
+        << tuned_out[1] << ", "
+        << tuned_out[2] << ", "
+        << tuned_out[3] << std::endl;
+
+    for (int f = 0; f < 3; ++f) {
+        sparse::TunedOperator<int, float> op(mul_matrix, static_cast<sparse::SpMVFormat>(f));
+        op.apply(tuned_out, dense_vector);
+        std::cout << format_names[f] << " Mul Matrix mul Vector: "
+            << tuned_out[0] << ", "
+            << tuned_out[1] << ", "
+            << tuned_out[2] << ", "
+            << tuned_out[3] << std::endl;
+    }
+
+    const char* out_of_core_path = "out_of_core_matrix.bin";
+    sparse::OutOfCoreCSRMatrix<int, float> out_of_core_matrix;
+    std::vector<float> out_of_core_out;
+
+    if (sparse::OutOfCoreCSRMatrix<int, float>::write(out_of_core_path, mul_matrix, 1) &&
+        out_of_core_matrix.open(out_of_core_path) &&
+        sparse::matmul(out_of_core_out, out_of_core_matrix, dense_vector)) {
+        std::cout << "Out of Core Mul Matrix (" << out_of_core_matrix.num_blocks() << " blocks) mul Vector: "
+            << out_of_core_out[0] << ", "
+            << out_of_core_out[1] << ", "
+            << out_of_core_out[2] << ", "
+            << out_of_core_out[3] << std::endl;
+    } else {
+        std::cout << "Out of Core Mul Matrix: I/O error" << std::endl;
+    }
+
+    // Stream the rows of the mul matrix without holding it in memory
+    sparse::OutOfCoreCSRWriter<int, float> out_of_core_writer;
+    bool streamed = out_of_core_writer.begin(out_of_core_path, 4, 4, 3);
+    for (int r = 0; streamed && r < 4; ++r) {
+        streamed = out_of_core_writer.append_row(
+            {0, 1, 2, 3},
+            {4.0f * r + 1.0f, 4.0f * r + 2.0f, 4.0f * r + 3.0f, 4.0f * r + 4.0f});
+    }
+    if (streamed && out_of_core_writer.finish() &&
+        out_of_core_matrix.open(out_of_core_path) &&
+        sparse::matmul(out_of_core_out, out_of_core_matrix, dense_vector)) {
+        std::cout << "Streamed Out of Core Mul Matrix (" << out_of_core_matrix.num_blocks() << " blocks) mul Vector: "
+            << out_of_core_out[0] << ", "
+            << out_of_core_out[1] << ", "
+            << out_of_core_out[2] << ", "
+            << out_of_core_out[3] << std::endl;
+    } else {
+        std::cout << "Streamed Out of Core Mul Matrix: I/O error" << std::endl;
+    }
+
+    // A header claiming more blocks than the file holds is rejected by open
+    std::FILE* truncated_file = std::fopen(out_of_core_path, "r+b");
+    if (truncated_file) {
+        uint64_t truncated_header[4] = {4, 4, 16, 1000000};
+        std::fwrite(truncated_header, sizeof(truncated_header), 1, truncated_file);
+        std::fclose(truncated_file);
+    }
+    std::cout << "Corrupt Out of Core Matrix opened: "
+        << (out_of_core_matrix.open(out_of_core_path) ? "yes" : "no") << std::endl;
+    std::remove(out_of_core_path);
+
+    // Same pattern, served from the cache
+    sparse::tune(mul_matrix, false, &tuning_cache);
+    std::cout << "Tuning Cache Entries: " << tuning_cache.size() << std::endl;
+
+    // Benchmarked choices are cached separately from heuristic ones
+    sparse::tune(mul_matrix, true, &tuning_cache);
+    std::cout << "Tuning Cache Entries after Benchmark: " << tuning_cache.size() << std::endl;
+
+    // One full row on a diagonal, too much ELL padding and BCSR fill to build
+    sparse::CSRMatrix<int, float> skewed_matrix(16, 16);
+    std::vector<int> skewed_columns;
+    std::vector<float> skewed_values;
+    for (int c = 0; c < 16; ++c) {
+        skewed_columns.push_back(c);
+        skewed_values.push_back(1.0f);
+    }
+    skewed_matrix.push_back_row(skewed_columns, skewed_values);
+    for (int r = 1; r < 16; ++r) {
+        skewed_matrix.push_back_row({r}, {1.0f});
+    }
+    std::cout << "Benchmarked Skewed Matrix Format: "
+        << format_names[static_cast<int>(sparse::benchmark_format(skewed_matrix))] << std::endl;
+
     sparse::CSRMatrix<int, float> out_mul_matrix(4, 4);
 
     sparse::matmul(out_mul_matrix, mul_matrix, mul_matrix);
@@ -152,6 +429,36 @@ int main(int argc, char** argv) {
         << csc_mul_matrix.get(3, 2) << ", "
         << csc_mul_matrix.get(3, 3) << std::endl;
 
+    std::vector<float> transpose_out;
+    std::vector<float> fused_out;
+    std::vector<float> fused_transpose_out;
+
+    sparse::matmul_transpose(transpose_out, mul_matrix, dense_vector);
+    std::cout << "Transpose Mul Matrix mul Vector: "
+        << transpose_out[0] << ", "
+        << transpose_out[1] << ", "
+        << transpose_out[2] << ", "
+        << transpose_out[3] << std::endl;
+
+    sparse::matmul(transpose_out, csc_mul_matrix, dense_vector, 2);
+    std::cout << "CSC Mul Matrix mul Vector: "
+        << transpose_out[0] << ", "
+        << transpose_out[1] << ", "
+        << transpose_out[2] << ", "
+        << transpose_out[3] << std::endl;
+
+    sparse::matmul_fused(fused_out, fused_transpose_out, mul_matrix, dense_vector, dense_vector, 2);
+    std::cout << "Fused Mul Matrix mul Vector: "
+        << fused_out[0] << ", "
+        << fused_out[1] << ", "
+        << fused_out[2] << ", "
+        << fused_out[3] << std::endl;
+    std::cout << "Fused Transpose Mul Matrix mul Vector: "
+        << fused_transpose_out[0] << ", "
+        << fused_transpose_out[1] << ", "
+        << fused_transpose_out[2] << ", "
+        << fused_transpose_out[3] << std::endl;
+
     out_mul_matrix.clear();
 
     std::cout << "Cleared Out Mul Matrix:" << std::endl;
@@ -192,5 +499,248 @@ int main(int argc, char** argv) {
         << out_mul_matrix.get(3, 2) << ", "
         << out_mul_matrix.get(3, 3) << std::endl;
 
+    sparse::CSRMatrix<int, float> sample_mask(4, 4);
+
+    sample_mask.push_back_row({0, 3}, {1.0f, 1.0f});
+    sample_mask.push_back_row({1}, {1.0f});
+    sample_mask.push_back_row({}, {});
+    sample_mask.push_back_row({0, 2}, {1.0f, 0.5f});
+
+    sparse::CSRMatrix<int, float> masked_mul_matrix(4, 4);
+
+    sparse::matmul_masked(masked_mul_matrix, sample_mask, mul_matrix, csc_mul_matrix);
+
+    std::cout << "Masked Mul Matrix (" << masked_mul_matrix.size() << " elements):" << std::endl;
+    std::cout << masked_mul_matrix.get(0, 0) << ", "
+        << masked_mul_matrix.get(0, 1) << ", "
+        << masked_mul_matrix.get(0, 2) << ", "
+        << masked_mul_matrix.get(0, 3) << std::endl;
+    std::cout << masked_mul_matrix.get(1, 0) << ", "
+        << masked_mul_matrix.get(1, 1) << ", "
+        << masked_mul_matrix.get(1, 2) << ", "
+        << masked_mul_matrix.get(1, 3) << std::endl;
+    std::cout << masked_mul_matrix.get(2, 0) << ", "
+        << masked_mul_matrix.get(2, 1) << ", "
+        << masked_mul_matrix.get(2, 2) << ", "
+        << masked_mul_matrix.get(2, 3) << std::endl;
+    std::cout << masked_mul_matrix.get(3, 0) << ", "
+        << masked_mul_matrix.get(3, 1) << ", "
+        << masked_mul_matrix.get(3, 2) << ", "
+        << masked_mul_matrix.get(3, 3) << std::endl;
+
+    // Dense rows of the mul matrix and of its transpose
+    std::vector<float> dense_lhs = {1.0f, 2.0f, 3.0f, 4.0f,
+                                    5.0f, 6.0f, 7.0f, 8.0f,
+                                    9.0f, 10.0f, 11.0f, 12.0f,
+                                    13.0f, 14.0f, 15.0f, 16.0f};
+    std::vector<float> dense_rhs_transpose = {1.0f, 5.0f, 9.0f, 13.0f,
+                                              2.0f, 6.0f, 10.0f, 14.0f,
+                                              3.0f, 7.0f, 11.0f, 15.0f,
+                                              4.0f, 8.0f, 12.0f, 16.0f};
+    sparse::CSRMatrix<int, float> sddmm_matrix(4, 4);
+
+    sparse::sddmm(sddmm_matrix, sample_mask, dense_lhs, dense_rhs_transpose, 4, 2);
+
+    std::cout << "SDDMM Matrix (" << sddmm_matrix.size() << " elements):" << std::endl;
+    std::cout << sddmm_matrix.get(0, 0) << ", "
+        << sddmm_matrix.get(0, 1) << ", "
+        << sddmm_matrix.get(0, 2) << ", "
+        << sddmm_matrix.get(0, 3) << std::endl;
+    std::cout << sddmm_matrix.get(1, 0) << ", "
+        << sddmm_matrix.get(1, 1) << ", "
+        << sddmm_matrix.get(1, 2) << ", "
+        << sddmm_matrix.get(1, 3) << std::endl;
+    std::cout << sddmm_matrix.get(2, 0) << ", "
+        << sddmm_matrix.get(2, 1) << ", "
+        << sddmm_matrix.get(2, 2) << ", "
+        << sddmm_matrix.get(2, 3) << std::endl;
+    std::cout << sddmm_matrix.get(3, 0) << ", "
+        << sddmm_matrix.get(3, 1) << ", "
+        << sddmm_matrix.get(3, 2) << ", "
+        << sddmm_matrix.get(3, 3) << std::endl;
+
+    // Directed ring 0 -> 1 -> 2 -> 3 -> 0 with weights on the elements
+    // (i, j) for the edge j -> i
+    sparse::CSRMatrix<int, float> graph_rows(4, 4);
+
+    graph_rows.push_back_row({3}, {4.0f});
+    graph_rows.push_back_row({0}, {1.0f});
+    graph_rows.push_back_row({1}, {2.0f});
+    graph_rows.push_back_row({2}, {3.0f});
+
+    sparse::CSCMatrix<int, float> graph_cols(4, 4);
+
+    graph_cols.push_back_col({1}, {1.0f});
+    graph_cols.push_back_col({2}, {2.0f});
+    graph_cols.push_back_col({3}, {3.0f});
+    graph_cols.push_back_col({0}, {4.0f});
+
+    std::vector<float> distances = {0.0f, 1.0f, 3.0f, 6.0f};
+    std::vector<float> relaxed;
+
+    sparse::matmul<sparse::MinPlus<float>>(relaxed, graph_rows, distances);
+    std::cout << "Min Plus Graph mul Distances: "
+        << relaxed[0] << ", "
+        << relaxed[1] << ", "
+        << relaxed[2] << ", "
+        << relaxed[3] << std::endl;
+
+    // Implicit elements are infinite distances under min-plus, not 0
+    sparse::CSRMatrix<int, float> two_cycle(2, 2);
+
+    two_cycle.push_back_row({1}, {5.0f});
+    two_cycle.push_back_row({0}, {7.0f});
+
+    sparse::MapVector<int, float> partial_distances;
+    partial_distances.insert(1, 2.0f);
+    sparse::MapVector<int, float> relaxed_map;
+
+    sparse::matmul<sparse::MinPlus<float>>(relaxed_map, two_cycle, partial_distances);
+    std::cout << "Min Plus Two Cycle mul Map Distances: "
+        << relaxed_map.get(0) << ", "
+        << relaxed_map.get(1) << std::endl;
+
+    std::vector<bool> relax_mask = {false, true};
+    sparse::MapVector<int, float> masked_relaxed_map;
+
+    sparse::matmul<sparse::MinPlus<float>>(masked_relaxed_map, two_cycle, partial_distances, &relax_mask, true);
+    std::cout << "Masked Min Plus Two Cycle mul Map Distances: "
+        << masked_relaxed_map.get(0) << ", "
+        << masked_relaxed_map.get(1) << std::endl;
+
+    sparse::ListVector<int, float> masked_list_mul_vector;
+
+    std::vector<bool> row_mask = {false, true, false, true};
+
+    sparse::matmul<sparse::PlusTimes<float>>(masked_list_mul_vector, csr_matrix, list_vector, &row_mask);
+    std::cout << "Masked List mul Vector (" << masked_list_mul_vector.size() << " elements): "
+        << masked_list_mul_vector.get(0) << ", "
+        << masked_list_mul_vector.get(1) << ", "
+        << masked_list_mul_vector.get(2) << ", "
+        << masked_list_mul_vector.get(3) << std::endl;
+
+    sparse::CSRMatrix<int, float> two_step(2, 2);
+
+    sparse::matmul<sparse::MinPlus<float>>(two_step, two_cycle, two_cycle);
+    std::cout << "Min Plus Two Cycle Squared:" << std::endl;
+    std::cout << two_step.get(0, 0) << ", "
+        << two_step.get(0, 1) << std::endl;
+    std::cout << two_step.get(1, 0) << ", "
+        << two_step.get(1, 1) << std::endl;
+
+    std::vector<int> levels;
+
+    sparse::bfs(levels, graph_rows, graph_cols, 2);
+    std::cout << "BFS Levels from 2: "
+        << levels[0] << ", "
+        << levels[1] << ", "
+        << levels[2] << ", "
+        << levels[3] << std::endl;
+
+    // Push a sparse frontier through the ring, excluding visited vertices
+    sparse::ListVector<int, float> ring_frontier;
+    ring_frontier.push_back(0, 1.0f);
+    ring_frontier.push_back(1, 1.0f);
+    std::vector<bool> ring_visited = {true, true, false, false};
+    sparse::ListVector<int, float> ring_next;
+
+    sparse::matmul<sparse::OrAnd<float>>(ring_next, graph_cols, ring_frontier, &ring_visited, true);
+    std::cout << "Masked Ring mul Frontier (" << ring_next.size() << " elements): "
+        << ring_next.get(0) << ", "
+        << ring_next.get(1) << ", "
+        << ring_next.get(2) << ", "
+        << ring_next.get(3) << std::endl;
+
+    // Edge 0 -> 1 is stored with value zero, so 1 and 2 are unreachable
+    // whether the search pushes (small alpha) or pulls (large alpha)
+    sparse::CSRMatrix<int, float> zero_edge_rows(3, 3);
+    sparse::CSCMatrix<int, float> zero_edge_cols(3, 3);
+
+    zero_edge_rows.push_back_row({}, {});
+    zero_edge_rows.push_back_row({0}, {0.0f});
+    zero_edge_rows.push_back_row({1}, {1.0f});
+    zero_edge_cols.push_back_col({1}, {0.0f});
+    zero_edge_cols.push_back_col({2}, {1.0f});
+    zero_edge_cols.push_back_col({}, {});
+
+    sparse::bfs(levels, zero_edge_rows, zero_edge_cols, 0, 1e-9);
+    std::cout << "BFS Zero Edge Levels (push): "
+        << levels[0] << ", "
+        << levels[1] << ", "
+        << levels[2] << std::endl;
+
+    sparse::bfs(levels, zero_edge_rows, zero_edge_cols, 0, 1e9);
+    std::cout << "BFS Zero Edge Levels (pull): "
+        << levels[0] << ", "
+        << levels[1] << ", "
+        << levels[2] << std::endl;
+
+    // Chain 0 -> 1 -> ... -> 47 never grows its frontier, so it only pushes
+    const int chain_length = 48;
+    sparse::CSRMatrix<int, float> chain_rows(chain_length, chain_length);
+    sparse::CSCMatrix<int, float> chain_cols(chain_length, chain_length);
+
+    chain_rows.push_back_row({}, {});
+    for (int v = 1; v < chain_length; ++v) {
+        chain_rows.push_back_row({v - 1}, {1.0f});
+        chain_cols.push_back_col({v}, {1.0f});
+    }
+    chain_cols.push_back_col({}, {});
+
+    std::vector<bool> chain_pulled;
+
+    sparse::bfs(levels, chain_rows, chain_cols, 0, 14.0, 24.0, &chain_pulled);
+    std::cout << "BFS Chain Levels: "
+        << levels[0] << ", "
+        << levels[1] << ", "
+        << levels[24] << ", "
+        << levels[chain_length - 1] << std::endl;
+    std::cout << "BFS Chain Steps (push P, pull L): ";
+    for (bool pull : chain_pulled) {
+        std::cout << (pull ? "L" : "P");
+    }
+    std::cout << std::endl;
+
+    // Broom 0 -> {1 ... 32} -> 33 -> 34 -> 35 pulls while the frontier grows
+    // into the bristles and pushes again once it shrinks to the handle
+    const int broom_size = 36;
+    sparse::CSRMatrix<int, float> broom_rows(broom_size, broom_size);
+    sparse::CSCMatrix<int, float> broom_cols(broom_size, broom_size);
+    std::vector<int> bristles;
+    std::vector<float> bristle_values;
+
+    for (int v = 1; v <= 32; ++v) {
+        bristles.push_back(v);
+        bristle_values.push_back(1.0f);
+    }
+    broom_rows.push_back_row({}, {});
+    for (int v = 1; v <= 32; ++v) {
+        broom_rows.push_back_row({0}, {1.0f});
+    }
+    broom_rows.push_back_row(bristles, bristle_values);
+    broom_rows.push_back_row({33}, {1.0f});
+    broom_rows.push_back_row({34}, {1.0f});
+    broom_cols.push_back_col(bristles, bristle_values);
+    for (int v = 1; v <= 32; ++v) {
+        broom_cols.push_back_col({33}, {1.0f});
+    }
+    broom_cols.push_back_col({34}, {1.0f});
+    broom_cols.push_back_col({35}, {1.0f});
+    broom_cols.push_back_col({}, {});
+
+    std::vector<bool> broom_pulled;
+
+    sparse::bfs(levels, broom_rows, broom_cols, 0, 14.0, 24.0, &broom_pulled);
+    std::cout << "BFS Broom Levels: "
+        << levels[0] << ", "
+        << levels[1] << ", "
+        << levels[33] << ", "
+        << levels[broom_size - 1] << std::endl;
+    std::cout << "BFS Broom Steps (push P, pull L): ";
+    for (bool pull : broom_pulled) {
+        std::cout << (pull ? "L" : "P");
+    }
+    std::cout << std::endl;
+
     return 0;
 }